@@ -0,0 +1,63 @@
+// memory_shim.h: a simulated wasm linear memory for running walloc.c natively
+//
+// walloc.c assumes that the heap ends at memory.size * PAGE_SIZE and grows by
+// memory.grow.  Reserving the address range from SIM_BASE up front and
+// treating the page count as an absolute address keeps that arithmetic valid
+// on a 64-bit host.  __heap_base has to be placed at SIM_BASE by the linker,
+// e.g. with -Wl,--defsym,sim_heap_base=0x40000000.
+
+#ifndef MEMORY_SHIM_H
+#define MEMORY_SHIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define SIM_BASE ((uintptr_t) 0x40000000)
+#define SIM_PAGE_SIZE 65536
+// Matches the maximum of the WebAssembly.Memory in game.ts.
+#define SIM_MAX_PAGES 1000
+
+static size_t sim_pages;
+
+static void
+sim_init(size_t initial_pages) {
+  void *mem = mmap((void*) SIM_BASE, (size_t) SIM_MAX_PAGES * SIM_PAGE_SIZE,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE
+                   | MAP_NORESERVE,
+                   -1, 0);
+  if (mem != (void*) SIM_BASE) {
+    perror("mmap");
+    exit(1);
+  }
+  sim_pages = SIM_BASE / SIM_PAGE_SIZE + initial_pages;
+}
+
+static size_t
+sim_memory_size(int memory) {
+  (void) memory;
+  return sim_pages;
+}
+
+static long
+sim_memory_grow(int memory, size_t delta) {
+  (void) memory;
+  if (sim_pages + delta > SIM_BASE / SIM_PAGE_SIZE + SIM_MAX_PAGES)
+    return -1;
+  size_t old = sim_pages;
+  sim_pages += delta;
+  return (long) old;
+}
+
+static size_t
+sim_used_pages(void) {
+  return sim_pages - SIM_BASE / SIM_PAGE_SIZE;
+}
+
+#define __builtin_wasm_memory_size sim_memory_size
+#define __builtin_wasm_memory_grow sim_memory_grow
+#define __heap_base sim_heap_base
+
+#endif // MEMORY_SHIM_H
@@ -0,0 +1,423 @@
+// walloc_bench.c: replay allocation traces against walloc.c on the host
+//
+// walloc.c is compiled into this program against the simulated linear memory
+// of memory_shim.h, so page growth happens as it would in the browser.  Every
+// trace runs in a forked child to start from an empty heap.
+//
+// Usage: walloc_bench [-p initial-pages] [-s samples] [trace-file...]
+//
+// Without trace files, the synthetic traces are run.  A trace file has one
+// event per line:
+//
+//   a ID SIZE   allocate SIZE bytes as object ID
+//   f ID        free object ID
+//   r ID SIZE   reallocate object ID to SIZE bytes
+//   frame       end of a frame
+//
+// and lines starting with '#' are comments.  Recorded traces come from a
+// main.wasm built with -DWALLOC_TRACE, see saveWallocTrace() in game.ts.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "memory_shim.h"
+
+// The wasm export attributes mean nothing here.
+#pragma GCC diagnostic ignored "-Wattributes"
+#undef NULL
+#define malloc walloc_malloc
+#define free walloc_free
+#define calloc walloc_calloc
+#define realloc walloc_realloc
+#define aligned_alloc walloc_aligned_alloc
+#define posix_memalign walloc_posix_memalign
+#include "../source/walloc.c"
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef aligned_alloc
+#undef posix_memalign
+
+enum trace_op { OP_ALLOC, OP_FREE, OP_REALLOC, OP_FRAME };
+
+struct trace_event {
+  enum trace_op op;
+  unsigned id;
+  size_t size;
+};
+
+struct trace {
+  const char *name;
+  struct trace_event *events;
+  size_t count;
+  size_t capacity;
+  unsigned next_id;
+  unsigned frames;
+};
+
+static void
+trace_push(struct trace *trace, enum trace_op op, unsigned id, size_t size) {
+  if (trace->count == trace->capacity) {
+    trace->capacity = trace->capacity ? trace->capacity * 2 : 4096;
+    trace->events = realloc(trace->events,
+                            trace->capacity * sizeof(struct trace_event));
+    if (!trace->events) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  trace->events[trace->count++] = (struct trace_event) { op, id, size };
+  if (op != OP_FRAME && id >= trace->next_id)
+    trace->next_id = id + 1;
+  if (op == OP_FRAME)
+    trace->frames++;
+}
+
+static unsigned
+trace_alloc(struct trace *trace, size_t size) {
+  unsigned id = trace->next_id;
+  trace_push(trace, OP_ALLOC, id, size);
+  return id;
+}
+static void
+trace_free(struct trace *trace, unsigned id) {
+  trace_push(trace, OP_FREE, id, 0);
+}
+static void
+trace_realloc(struct trace *trace, unsigned id, size_t size) {
+  trace_push(trace, OP_REALLOC, id, size);
+}
+static void
+trace_frame(struct trace *trace) {
+  trace_push(trace, OP_FRAME, 0, 0);
+}
+
+static int
+trace_load(struct trace *trace, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return 0;
+  }
+  trace->name = path;
+  char line[256];
+  unsigned lineno = 0;
+  while (fgets(line, sizeof line, file)) {
+    lineno++;
+    unsigned id;
+    size_t size;
+    if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+      continue;
+    if (!strncmp(line, "frame", 5))
+      trace_frame(trace);
+    else if (sscanf(line, "a %u %zu", &id, &size) == 2)
+      trace_push(trace, OP_ALLOC, id, size);
+    else if (sscanf(line, "f %u", &id) == 1)
+      trace_free(trace, id);
+    else if (sscanf(line, "r %u %zu", &id, &size) == 2)
+      trace_realloc(trace, id, size);
+    else
+      fprintf(stderr, "%s:%u: ignoring malformed event\n", path, lineno);
+  }
+  fclose(file);
+  return 1;
+}
+
+// Synthetic traces.  A fixed seed keeps them identical from run to run.
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t
+rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+static size_t
+rng_range(size_t lo, size_t hi) {
+  return lo + rng() % (hi - lo + 1);
+}
+// Mostly tiny objects, some up to the largest small-object class.
+static size_t
+rng_small_size(void) {
+  return rng_range(1, (rng() & 3) ? 64 : 256);
+}
+
+struct survivor {
+  unsigned id;
+  unsigned expires;
+};
+
+// Objects that outlive the frame that made them: sounds, particles, text.
+struct survivors {
+  struct survivor items[4096];
+  unsigned count;
+};
+
+static void
+expire_survivors(struct trace *trace, struct survivors *survivors,
+                 unsigned frame) {
+  for (unsigned i = 0; i < survivors->count;) {
+    if (survivors->items[i].expires <= frame) {
+      trace_free(trace, survivors->items[i].id);
+      survivors->items[i] = survivors->items[--survivors->count];
+    } else {
+      i++;
+    }
+  }
+}
+
+// One frame of steady-state work: scratch allocations that die at the end
+// of the frame, a scratch array grown by doubling, and a few objects that
+// survive for a random number of frames.
+static void
+churn_frame(struct trace *trace, struct survivors *survivors, unsigned frame,
+            unsigned scratch_count) {
+  unsigned scratch[256];
+  unsigned count = 0;
+  for (unsigned i = 0; i < scratch_count && count < 256; i++) {
+    size_t size = (rng() % 16) ? rng_small_size() : rng_range(512, 8192);
+    scratch[count++] = trace_alloc(trace, size);
+  }
+
+  unsigned array = trace_alloc(trace, 64);
+  size_t array_size = rng_range(128, 16384);
+  for (size_t size = 128; size <= array_size; size *= 2)
+    trace_realloc(trace, array, size);
+  trace_free(trace, array);
+
+  unsigned keep = rng_range(0, 8);
+  for (unsigned i = 0; i < keep && survivors->count < 4096; i++) {
+    size_t size = (rng() % 4) ? rng_small_size() : rng_range(256, 4096);
+    survivors->items[survivors->count++] =
+      (struct survivor) { trace_alloc(trace, size),
+                          frame + rng_range(1, 120) };
+  }
+
+  for (unsigned i = 0; i < count; i++)
+    trace_free(trace, scratch[i]);
+  expire_survivors(trace, survivors, frame);
+  trace_frame(trace);
+}
+
+// Asset loading: per asset a uri string, a decode buffer that is dropped
+// right away, the pixel buffer and a few records that stay.
+static void
+make_load_burst(struct trace *trace) {
+  trace->name = "load-burst";
+  for (unsigned asset = 0; asset < 300; asset++) {
+    trace_alloc(trace, rng_range(16, 64));
+    unsigned decode = trace_alloc(trace, rng_range(4096, 65536));
+    trace_alloc(trace, rng_range(16, 320) * rng_range(16, 200) * 4);
+    trace_free(trace, decode);
+    for (unsigned i = rng_range(1, 4); i; i--)
+      trace_alloc(trace, rng_small_size());
+    if (asset % 10 == 9)
+      trace_frame(trace);
+  }
+}
+
+static void
+make_frame_churn(struct trace *trace) {
+  static struct survivors survivors;
+  trace->name = "frame-churn";
+  for (unsigned frame = 0; frame < 2000; frame++)
+    churn_frame(trace, &survivors, frame, rng_range(50, 200));
+}
+
+// Level transitions: each scene loads large images and many small objects,
+// plays for a while, and is torn down once the next scene has loaded, so
+// two scenes are briefly resident and their frees interleave.
+static void
+make_scene_swap(struct trace *trace) {
+  static struct survivors survivors;
+  static unsigned scene_objects[2][1024];
+  unsigned scene_counts[2] = { 0, 0 };
+  unsigned frame = 0;
+  trace->name = "scene-swap";
+  for (unsigned scene = 0; scene < 12; scene++) {
+    unsigned *objects = scene_objects[scene % 2];
+    unsigned *count = &scene_counts[scene % 2];
+    for (unsigned i = 0; i < 24; i++)
+      objects[(*count)++] = trace_alloc(trace, rng_range(16384, 1 << 20));
+    for (unsigned i = 0; i < 500; i++)
+      objects[(*count)++] = trace_alloc(trace, rng_small_size());
+    trace_frame(trace);
+
+    unsigned *previous = scene_objects[(scene + 1) % 2];
+    unsigned *previous_count = &scene_counts[(scene + 1) % 2];
+    for (unsigned i = 0; i < *previous_count; i++)
+      trace_free(trace, previous[i]);
+    *previous_count = 0;
+
+    for (unsigned i = 0; i < 60; i++)
+      churn_frame(trace, &survivors, frame++, rng_range(20, 100));
+  }
+}
+
+// Replay.
+
+static uint64_t
+now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+print_sample(size_t event, size_t live) {
+  struct walloc_stats *stats = walloc_stats();
+  printf("%10zu %6zu %10zu %10zu %12zu %5zu.%zu%%\n",
+         event, sim_used_pages(), live >> 10, stats->free_large_bytes >> 10,
+         stats->largest_free_large_object >> 10,
+         stats->fragmentation / 10, stats->fragmentation % 10);
+}
+
+// Time the trace in SAMPLES slices, taking heap statistics between slices
+// outside the timed region.
+static void
+replay(struct trace *trace, size_t initial_pages, unsigned samples) {
+  sim_init(initial_pages);
+
+  void **objects = calloc(trace->next_id + 1, sizeof(void*));
+  size_t *sizes = calloc(trace->next_id + 1, sizeof(size_t));
+  size_t ops = 0, failed = 0, live = 0, peak_live = 0;
+  uint64_t elapsed = 0;
+  size_t slice = trace->count / samples + 1;
+
+  printf("== %s: %zu events, %u frames\n", trace->name, trace->count,
+         trace->frames);
+  printf("%10s %6s %10s %10s %12s %6s\n",
+         "event", "pages", "live KiB", "free KiB", "largest KiB", "frag");
+
+  for (size_t begin = 0; begin < trace->count; begin += slice) {
+    size_t end = begin + slice < trace->count ? begin + slice : trace->count;
+    uint64_t start = now_ns();
+    for (size_t i = begin; i < end; i++) {
+      struct trace_event *event = &trace->events[i];
+      void **object = &objects[event->id];
+      switch (event->op) {
+        case OP_ALLOC:
+          if (*object)
+            break;
+          *object = walloc_malloc(event->size);
+          ops++;
+          if (!*object) {
+            failed++;
+            break;
+          }
+          sizes[event->id] = event->size;
+          live += event->size;
+          break;
+        case OP_FREE:
+          // Recordings can free objects allocated before they started.
+          if (!*object)
+            break;
+          walloc_free(*object);
+          ops++;
+          *object = NULL;
+          live -= sizes[event->id];
+          break;
+        case OP_REALLOC: {
+          if (!*object)
+            break;
+          void *resized = walloc_realloc(*object, event->size);
+          ops++;
+          if (!resized) {
+            failed++;
+            break;
+          }
+          *object = resized;
+          live += event->size - sizes[event->id];
+          sizes[event->id] = event->size;
+          break;
+        }
+        case OP_FRAME:
+          break;
+      }
+      if (live > peak_live)
+        peak_live = live;
+    }
+    elapsed += now_ns() - start;
+    print_sample(end, live);
+  }
+
+  struct walloc_stats *stats = walloc_stats();
+  printf("%.1f ns/op over %zu ops, %zu failed\n",
+         ops ? (double) elapsed / ops : 0.0, ops, failed);
+  printf("peak heap %zu pages, %zu grows adding %zu KiB, peak live %zu KiB\n",
+         sim_used_pages(), stats->grow_count, stats->grow_bytes >> 10,
+         peak_live >> 10);
+  printf("largest free block at end %zu KiB\n\n",
+         stats->largest_free_large_object >> 10);
+}
+
+static void
+run(struct trace *trace, size_t initial_pages, unsigned samples) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (!pid) {
+    replay(trace, initial_pages, samples);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    fprintf(stderr, "%s: replay crashed\n", trace->name);
+}
+
+int
+main(int argc, char **argv) {
+  size_t initial_pages = 1;
+  unsigned samples = 16;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+    switch (opt) {
+      case 'p':
+        initial_pages = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        samples = strtoul(optarg, NULL, 0);
+        if (!samples)
+          samples = 1;
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-p initial-pages] [-s samples] [trace-file...]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind == argc) {
+    void (*makers[])(struct trace*) =
+      { make_load_burst, make_frame_churn, make_scene_swap };
+    for (unsigned i = 0; i < sizeof makers / sizeof makers[0]; i++) {
+      struct trace trace = { 0 };
+      makers[i](&trace);
+      run(&trace, initial_pages, samples);
+      free(trace.events);
+    }
+    return 0;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    struct trace trace = { 0 };
+    if (trace_load(&trace, argv[i]))
+      run(&trace, initial_pages, samples);
+    free(trace.events);
+  }
+  return 0;
+}
@@ -0,0 +1,173 @@
+#ifndef ANIMATION
+#define ANIMATION
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "imports.hpp"
+#include "lut.hpp"
+
+/*
+    an animation cut from a sprite sheet: one image, loaded or drawn once,
+    with the frames in a grid, left to right and then down. each frame is a
+    strided view into the sheet and shows for its own number of milliseconds
+
+    frames are drawn from a cache that holds them upscaled, and graded if a
+    lut is given, each built the first time it is asked for. every instance
+    of the animation shares the sheet and the cache, so drawing one is a 1x
+    blit of a ready view, with no lookups, expansion or allocation per frame
+*/
+class animation
+{
+    image_view *frames = nullptr;
+    image_view *cached = nullptr;
+    u32 *ends_ms = nullptr;
+    bool *built = nullptr;
+    u32 *cache = nullptr;
+
+    u32 count = 0;
+    u32 period_ms = 0;
+    i32 upscale = 1;
+    color_lut const *lut = nullptr;
+
+    /*what frame() gives when there are no frames*/
+    static constexpr image_view empty{};
+
+    void build(u32 index)
+    {
+        image_view const &src = frames[index];
+        image_view const &dst = cached[index];
+
+        for (i32 y = 0; y < dst.h; ++y)
+        {
+            u32 const *const src_row = src.row(y / upscale);
+            u32 *const dst_row = dst.row(y);
+
+            for (i32 x = 0; x < dst.w; ++x)
+            {
+                dst_row[x] = src_row[x / upscale];
+            }
+        }
+
+        if (lut)
+        {
+            bake(dst, dst, *lut);
+        }
+
+        built[index] = true;
+    }
+
+public:
+    /*no destructor so an animation at namespace scope needs no atexit registration*/
+    constexpr animation() = default;
+    animation(animation const &) = delete;
+    animation &operator=(animation const &) = delete;
+
+    /*frees the frame tables and the cache, frame() gives empty views until init() again*/
+    void release()
+    {
+        free(frames);
+        free(cache);
+        frames = nullptr;
+        cache = nullptr;
+        count = 0;
+    }
+
+    /*
+        length frames of frame_w by frame_h from sheet, frame i showing
+        for durations_ms[i]. the sheet has to outlive the animation, the
+        cache does not keep it. false if the frames do not fit the sheet or
+        there was no memory, frame() then gives empty views
+    */
+    bool init(image_view const &sheet, i32 frame_w, i32 frame_h, u32 const *durations_ms, u32 length, i32 scale = 1, color_lut const *grade = nullptr)
+    {
+        release();
+
+        if (frame_w <= 0 || frame_h <= 0 || scale <= 0)
+        {
+            return false;
+        }
+
+        i32 const columns = sheet.w / frame_w;
+
+        if (!length || columns <= 0 || static_cast<i32>((length + columns - 1) / columns) * frame_h > sheet.h)
+        {
+            return false;
+        }
+
+        size_t const frame_pixels = static_cast<size_t>(frame_w) * scale * frame_h * scale;
+        size_t const table_bytes = length * (2 * sizeof(image_view) + sizeof(u32) + sizeof(bool));
+        frames = reinterpret_cast<image_view*>(malloc(table_bytes));
+        cache = reinterpret_cast<u32*>(aligned_alloc(16, ((length * frame_pixels + 3) & ~size_t(3)) * sizeof(u32)));
+
+        if (!frames || !cache)
+        {
+            release();
+            return false;
+        }
+
+        cached = frames + length;
+        ends_ms = reinterpret_cast<u32*>(cached + length);
+        built = reinterpret_cast<bool*>(ends_ms + length);
+        count = length;
+        upscale = scale;
+        lut = grade;
+        period_ms = 0;
+
+        for (u32 i = 0; i < length; ++i)
+        {
+            frames[i] = sheet.sub((i % columns) * frame_w, (i / columns) * frame_h, frame_w, frame_h);
+            cached[i] = { cache + i * frame_pixels, frame_w * scale, frame_h * scale, frame_w * scale };
+            period_ms += math::max(durations_ms[i], 1u);
+            ends_ms[i] = period_ms;
+            built[i] = false;
+        }
+
+        return true;
+    }
+
+    /*the frame showing ms into the animation, looping*/
+    u32 frame_index(f64 ms) const
+    {
+        if (!count)
+        {
+            return 0;
+        }
+
+        f64 const t = ms - __builtin_floor(ms / period_ms) * period_ms;
+        u32 i = 0;
+
+        while (i + 1 < count && t >= ends_ms[i])
+        {
+            i += 1;
+        }
+
+        return i;
+    }
+
+    /*the cached, upscaled view of frame index, empty past the last frame*/
+    image_view const &frame(u32 index)
+    {
+        if (index >= count)
+        {
+            return empty;
+        }
+
+        if (!built[index])
+        {
+            build(index);
+        }
+
+        return cached[index];
+    }
+
+    image_view const &frame_at(f64 ms)
+    {
+        return frame(frame_index(ms));
+    }
+
+    u32 frame_count() const
+    {
+        return count;
+    }
+};
+
+#endif /* ANIMATION */
@@ -0,0 +1,173 @@
+#ifndef ARENA
+#define ARENA
+#include "wasmdefs.hpp"
+
+/*
+    linear allocator for scratch memory that dies together, e.g. everything a
+    frame needs. allocation is a pointer bump inside a block obtained from
+    malloc; a frame that outgrows the block chains another one, and the next
+    reset() folds them into a single block big enough for the whole frame
+*/
+class arena
+{
+    struct block
+    {
+        block *prev;
+        char *cursor;
+        char *end;
+    };
+
+    static constexpr size_t default_alignment = 16;
+
+    block *current = nullptr;
+    size_t block_size = 0x10000;
+
+    static char *block_begin(block *b)
+    {
+        return reinterpret_cast<char*>(b + 1);
+    }
+
+    static char *align_up(char *ptr, size_t alignment)
+    {
+        return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(alignment - 1));
+    }
+
+    /*false if there was no memory, current is left as it was*/
+    bool push_block(size_t min_size)
+    {
+        size_t const size = min_size + sizeof(block) > block_size ? min_size + sizeof(block) : block_size;
+        block *const b = reinterpret_cast<block*>(malloc(size));
+
+        if (!b)
+        {
+            return false;
+        }
+
+        b->prev = current;
+        b->cursor = block_begin(b);
+        b->end = reinterpret_cast<char*>(b) + size;
+        current = b;
+
+        return true;
+    }
+
+    void pop_block()
+    {
+        block *const prev = current->prev;
+        free(current);
+        current = prev;
+    }
+
+public:
+    struct marker
+    {
+        block *owner;
+        char *cursor;
+    };
+
+    /*keeps whatever was allocated before it alive, drops everything after*/
+    class scope
+    {
+        arena &owner;
+        marker const saved;
+    public:
+        explicit scope(arena &a) : owner(a), saved(a.mark()) {}
+        ~scope() { owner.release(saved); }
+        scope(scope const &) = delete;
+        scope &operator=(scope const &) = delete;
+    };
+
+    /*null if there was no memory for another block*/
+    void *alloc_bytes(size_t size, size_t alignment = default_alignment)
+    {
+        if (current)
+        {
+            char *const ptr = align_up(current->cursor, alignment);
+
+            if (ptr + size <= current->end)
+            {
+                current->cursor = ptr + size;
+                return ptr;
+            }
+        }
+
+        if (!push_block(size + alignment))
+        {
+            return nullptr;
+        }
+
+        char *const ptr = align_up(current->cursor, alignment);
+        current->cursor = ptr + size;
+        return ptr;
+    }
+
+    template <typename T>
+    T *alloc(size_t n = 1)
+    {
+        constexpr size_t alignment = alignof(T) > default_alignment ? alignof(T) : default_alignment;
+        return static_cast<T*>(alloc_bytes(n * sizeof(T), alignment));
+    }
+
+    marker mark() const
+    {
+        return {current, current ? current->cursor : nullptr};
+    }
+
+    void release(marker m)
+    {
+        while (current && current != m.owner && current->prev)
+        {
+            pop_block();
+        }
+
+        if (current)
+        {
+            current->cursor = current == m.owner ? m.cursor : block_begin(current);
+        }
+    }
+
+    void reset()
+    {
+        if (!current)
+        {
+            return;
+        }
+
+        if (current->prev)
+        {
+            size_t total = 0;
+
+            while (current)
+            {
+                total += current->end - reinterpret_cast<char*>(current);
+                pop_block();
+            }
+
+            size_t const previous = block_size;
+            block_size = total;
+
+            /*without room for the merged block the arena starts over empty and chains again*/
+            if (!push_block(0))
+            {
+                block_size = previous;
+                return;
+            }
+        }
+
+        current->cursor = block_begin(current);
+    }
+
+    size_t used() const
+    {
+        size_t res = 0;
+
+        for (block *b = current; b; b = b->prev)
+        {
+            res += b->cursor - block_begin(b);
+        }
+
+        return res;
+    }
+};
+
+#endif /* ARENA */
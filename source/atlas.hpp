@@ -0,0 +1,481 @@
+#ifndef ATLAS
+#define ATLAS
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "resources.hpp"
+
+/*a view of the packed pixels plus where in which page they ended up*/
+struct atlas_region : image_view
+{
+    u32 page;
+    i32 x, y;
+};
+
+using atlas_handle = handle<atlas_region>;
+
+/*
+    copies loaded images into a few large pages so sprites drawn together sit
+    next to each other in memory instead of in one malloc'd buffer apiece.
+    every page is filled by a skyline packer: the top edge of what has been
+    placed so far is a list of horizontal segments, and each rectangle goes
+    where its bottom ends up highest, ties going to the narrowest segment
+
+    images are queued with add(), which takes over the caller's reference,
+    and build() packs whatever is queued once all of it is ready, tallest
+    first, then releases the originals so the host frees their buffers.
+    images sharing a nonzero group are laid out in rows as one block, so a
+    set of icons always lands side by side
+*/
+class atlas
+{
+    struct skyline_node
+    {
+        i32 x, y, w;
+    };
+
+    struct page
+    {
+        u32 *pixels;
+        i32 w, h;
+        skyline_node *nodes;
+        u32 node_count;
+    };
+
+    struct entry
+    {
+        image_handle source;
+        u32 group;
+        bool packed;
+        atlas_region region;
+    };
+
+    /*a single image or a whole group, placed as one rectangle*/
+    struct item
+    {
+        u32 first;
+        u32 group;
+        i32 w, h;
+    };
+
+    page *pages = nullptr;
+    u32 page_count = 0;
+
+    entry *entries = nullptr;
+    u32 entry_count = 0;
+    u32 entry_capacity = 0;
+    u32 pending = 0;
+    bool out_of_memory = false;
+
+    i32 page_size;
+
+    bool add_page(i32 w, i32 h)
+    {
+        page *const new_pages = reinterpret_cast<page*>(realloc(pages, (page_count + 1) * sizeof(page)));
+
+        if (!new_pages)
+        {
+            return false;
+        }
+
+        pages = new_pages;
+
+        page &p = pages[page_count];
+        p.pixels = reinterpret_cast<u32*>(aligned_alloc(16, static_cast<size_t>(w) * h * sizeof(u32)));
+        p.nodes = reinterpret_cast<skyline_node*>(malloc((w + 1) * sizeof(skyline_node)));
+
+        if (!p.pixels || !p.nodes)
+        {
+            free(p.pixels);
+            free(p.nodes);
+            return false;
+        }
+
+        memset(p.pixels, 0, static_cast<size_t>(w) * h * sizeof(u32));
+        p.w = w;
+        p.h = h;
+        p.nodes[0] = { 0, 0, w };
+        p.node_count = 1;
+        page_count += 1;
+
+        return true;
+    }
+
+    /*y a w by h rectangle would rest at if its left edge sits on node i, -1 if it does not fit*/
+    static i32 fit(page const &p, u32 i, i32 w, i32 h)
+    {
+        if (p.nodes[i].x + w > p.w)
+        {
+            return -1;
+        }
+
+        i32 y = 0;
+
+        for (i32 remaining = w; remaining > 0; remaining -= p.nodes[i++].w)
+        {
+            y = math::max(y, p.nodes[i].y);
+
+            if (y + h > p.h)
+            {
+                return -1;
+            }
+        }
+
+        return y;
+    }
+
+    static bool find_position(page const &p, i32 w, i32 h, u32 &node, i32 &y)
+    {
+        i32 best_bottom = p.h + 1;
+        i32 best_width = p.w + 1;
+
+        for (u32 i = 0; i < p.node_count; ++i)
+        {
+            i32 const top = fit(p, i, w, h);
+
+            if (top < 0)
+            {
+                continue;
+            }
+
+            if (top + h < best_bottom || (top + h == best_bottom && p.nodes[i].w < best_width))
+            {
+                best_bottom = top + h;
+                best_width = p.nodes[i].w;
+                node = i;
+                y = top;
+            }
+        }
+
+        return best_bottom <= p.h;
+    }
+
+    static void remove_node(page &p, u32 i)
+    {
+        __builtin_memmove(p.nodes + i, p.nodes + i + 1, (p.node_count - i - 1) * sizeof(skyline_node));
+        p.node_count -= 1;
+    }
+
+    /*raises the skyline over [x, x + w) to y + h*/
+    static void place(page &p, u32 i, i32 y, i32 w, i32 h)
+    {
+        i32 const x = p.nodes[i].x;
+
+        __builtin_memmove(p.nodes + i + 1, p.nodes + i, (p.node_count - i) * sizeof(skyline_node));
+        p.nodes[i] = { x, y + h, w };
+        p.node_count += 1;
+
+        while (i + 1 < p.node_count)
+        {
+            skyline_node &next = p.nodes[i + 1];
+            i32 const covered = x + w - next.x;
+
+            if (covered <= 0)
+            {
+                break;
+            }
+
+            if (covered < next.w)
+            {
+                next.x += covered;
+                next.w -= covered;
+                break;
+            }
+
+            remove_node(p, i + 1);
+        }
+
+        for (u32 j = 0; j + 1 < p.node_count;)
+        {
+            if (p.nodes[j].y == p.nodes[j + 1].y)
+            {
+                p.nodes[j].w += p.nodes[j + 1].w;
+                remove_node(p, j + 1);
+            }
+            else
+            {
+                j += 1;
+            }
+        }
+    }
+
+    /*lays out a group's members left to right in rows no wider than a page, offsets go into their regions*/
+    item measure_group(u32 first)
+    {
+        u32 const group = entries[first].group;
+        item res = { first, group, 0, 0 };
+        i32 row_x = 0;
+        i32 row_y = 0;
+        i32 row_h = 0;
+
+        for (u32 i = first; i < entry_count; ++i)
+        {
+            entry &e = entries[i];
+
+            if (e.packed || e.group != group)
+            {
+                continue;
+            }
+
+            if (row_x && row_x + e.region.w > page_size)
+            {
+                row_y += row_h;
+                row_x = 0;
+                row_h = 0;
+            }
+
+            e.region.x = row_x;
+            e.region.y = row_y;
+            row_x += e.region.w;
+            row_h = math::max(row_h, e.region.h);
+            res.w = math::max(res.w, row_x);
+        }
+
+        res.h = row_y + row_h;
+        return res;
+    }
+
+    /*false if it needed a new page and there was no memory for one*/
+    bool pack_item(item const &it)
+    {
+        u32 node = 0;
+        i32 y = 0;
+        u32 index = 0;
+
+        while (index < page_count && !find_position(pages[index], it.w, it.h, node, y))
+        {
+            index += 1;
+        }
+
+        if (index == page_count)
+        {
+            if (!add_page(math::max(page_size, it.w), math::max(page_size, it.h)))
+            {
+                return false;
+            }
+
+            find_position(pages[index], it.w, it.h, node, y);
+        }
+
+        page &p = pages[index];
+        i32 const x = p.nodes[node].x;
+        place(p, node, y, it.w, it.h);
+
+        for (u32 i = it.first; i < entry_count; ++i)
+        {
+            entry &e = entries[i];
+
+            if (e.packed || e.group != it.group || (!it.group && i != it.first))
+            {
+                continue;
+            }
+
+            image const &src = *resources::get(e.source);
+            atlas_region &r = e.region;
+
+            if (!it.group)
+            {
+                r.x = 0;
+                r.y = 0;
+            }
+
+            r.page = index;
+            r.x += x;
+            r.y += y;
+            r.stride = p.w;
+            r.data = p.pixels + r.y * p.w + r.x;
+
+            for (i32 row = 0; row < r.h; ++row)
+            {
+                memcpy(r.data + row * r.stride, src.data + row * src.w, r.w * sizeof(u32));
+            }
+
+            resources::release(e.source);
+            e.source = {};
+            e.packed = true;
+            pending -= 1;
+
+            if (!it.group)
+            {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+public:
+    /*
+        constexpr and no destructor, so the global atlas is constant
+        initialized and needs no atexit registration. release() frees it
+    */
+    explicit constexpr atlas(i32 page_size = 512) : page_size(page_size) {}
+    atlas(atlas const &) = delete;
+    atlas &operator=(atlas const &) = delete;
+
+    /*frees the pages and releases whatever was still queued, every handle goes stale*/
+    void release()
+    {
+        for (u32 i = 0; i < page_count; ++i)
+        {
+            free(pages[i].pixels);
+            free(pages[i].nodes);
+        }
+
+        for (u32 i = 0; i < entry_count; ++i)
+        {
+            if (!entries[i].packed)
+            {
+                resources::release(entries[i].source);
+            }
+        }
+
+        free(pages);
+        free(entries);
+        pages = nullptr;
+        page_count = 0;
+        entries = nullptr;
+        entry_count = 0;
+        entry_capacity = 0;
+        pending = 0;
+        out_of_memory = false;
+    }
+
+    atlas_handle add(image_handle img, u32 group = 0)
+    {
+        if (entry_count == entry_capacity)
+        {
+            u32 const capacity = entry_capacity ? entry_capacity * 2 : 16;
+            entry *const new_entries = reinterpret_cast<entry*>(realloc(entries, capacity * sizeof(entry)));
+
+            if (!new_entries)
+            {
+                return {};
+            }
+
+            entries = new_entries;
+            entry_capacity = capacity;
+        }
+
+        entries[entry_count] = { img, group, false, atlas_region{} };
+        pending += 1;
+
+        return { entry_count++, 1 };
+    }
+
+    /*
+        false while some queued image is still loading, nothing is packed
+        until all of them are in. also false, for good, once packing ran
+        out of memory, see failed()
+    */
+    bool build()
+    {
+        if (!pending)
+        {
+            return true;
+        }
+
+        if (out_of_memory)
+        {
+            return false;
+        }
+
+        for (u32 i = 0; i < entry_count; ++i)
+        {
+            entry &e = entries[i];
+
+            if (e.packed)
+            {
+                continue;
+            }
+
+            if (!resources::image_ready(e.source))
+            {
+                return false;
+            }
+
+            image const &src = *resources::get(e.source);
+            e.region.w = src.w;
+            e.region.h = src.h;
+        }
+
+        item *const items = reinterpret_cast<item*>(malloc(pending * sizeof(item)));
+        u32 item_count = 0;
+
+        if (!items)
+        {
+            out_of_memory = true;
+            return false;
+        }
+
+        for (u32 i = 0; i < entry_count; ++i)
+        {
+            entry const &e = entries[i];
+
+            if (e.packed)
+            {
+                continue;
+            }
+
+            if (!e.group)
+            {
+                items[item_count++] = { i, 0, e.region.w, e.region.h };
+                continue;
+            }
+
+            bool seen = false;
+
+            for (u32 j = 0; j < item_count && !seen; ++j)
+            {
+                seen = items[j].group == e.group;
+            }
+
+            if (!seen)
+            {
+                items[item_count++] = measure_group(i);
+            }
+        }
+
+        /*tallest first, a handful of images so insertion sort it is*/
+        for (u32 i = 1; i < item_count; ++i)
+        {
+            item const it = items[i];
+            u32 j = i;
+
+            while (j && items[j - 1].h < it.h)
+            {
+                items[j] = items[j - 1];
+                j -= 1;
+            }
+
+            items[j] = it;
+        }
+
+        for (u32 i = 0; i < item_count && !out_of_memory; ++i)
+        {
+            out_of_memory = !pack_item(items[i]);
+        }
+
+        free(items);
+
+        return !pending;
+    }
+
+    /*null until build() has packed the image*/
+    atlas_region const *get(atlas_handle h) const
+    {
+        return h && h.index < entry_count && entries[h.index].packed ? &entries[h.index].region : nullptr;
+    }
+
+    u32 pages_used() const
+    {
+        return page_count;
+    }
+
+    /*true once build() could not get the memory to pack everything, some images are left unpacked*/
+    bool failed() const
+    {
+        return out_of_memory;
+    }
+};
+
+#endif /* ATLAS */
@@ -0,0 +1,181 @@
+#ifndef BLEND
+#define BLEND
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "linear.hpp"
+
+/*
+    blend modes. a mode only says how a source channel s mixes with the
+    destination channel d, once, as a template over the lane type: a u32
+    holding one channel for the scalar kernel or a v128_t of eight u16
+    channels, two pixels, for the simd one. both kernels then fade from d
+    to the mix by source alpha the same way source-over does, so every
+    mode keeps transparent pixels transparent
+
+    k and t are per draw constants, k a colour spread over the channels
+    and t an amount, for modes that need them
+*/
+namespace blend_lanes
+{
+    inline u32 mul(u32 a, u32 b) { return (a * b + 255) >> 8; }
+    inline u32 add_sat(u32 a, u32 b) { return math::min(a + b, 255u); }
+    inline u32 inv(u32 a) { return 255 - a; }
+    inline u32 lerp(u32 a, u32 b, u32 t) { return (a * (255 - t) + b * t + 255) >> 8; }
+
+    /*a*b + 255 tops out at 65280, still inside u16, and so does the lerp*/
+    inline v128_t mul(v128_t a, v128_t b) { return wasm_u16x8_shr(wasm_i16x8_add(wasm_i16x8_mul(a, b), wasm_u16x8_splat(255)), 8); }
+    inline v128_t add_sat(v128_t a, v128_t b) { return wasm_u16x8_min(wasm_i16x8_add(a, b), wasm_u16x8_splat(255)); }
+    inline v128_t inv(v128_t a) { return wasm_i16x8_sub(wasm_u16x8_splat(255), a); }
+
+    inline v128_t lerp(v128_t a, v128_t b, v128_t t)
+    {
+        v128_t const sum = wasm_i16x8_add(wasm_i16x8_mul(a, inv(t)), wasm_i16x8_mul(b, t));
+        return wasm_u16x8_shr(wasm_i16x8_add(sum, wasm_u16x8_splat(255)), 8);
+    }
+}
+
+struct blend_over
+{
+    template <typename L> L mix(L s, L, L, L) const { return s; }
+};
+
+/*lights and sparks*/
+struct blend_add
+{
+    template <typename L> L mix(L s, L d, L, L) const { return blend_lanes::add_sat(s, d); }
+};
+
+/*shadows, white leaves the destination alone*/
+struct blend_multiply
+{
+    template <typename L> L mix(L s, L d, L, L) const { return blend_lanes::mul(s, d); }
+};
+
+/*the inverse of multiply, black leaves the destination alone*/
+struct blend_screen
+{
+    template <typename L> L mix(L s, L d, L, L) const
+    {
+        using namespace blend_lanes;
+        return inv(mul(inv(s), inv(d)));
+    }
+};
+
+/*pulls the sprite toward color by amount before it lands, depth cueing for far layers*/
+struct blend_tint
+{
+    u32 color;
+    u32 amount;
+
+    template <typename L> L mix(L s, L, L k, L t) const { return blend_lanes::lerp(s, k, t); }
+};
+
+template <typename Mode>
+inline u32 blend_constant_color(Mode const &mode)
+{
+    if constexpr (requires { mode.color; }) { return mode.color; } else { return 0; }
+}
+
+template <typename Mode>
+inline u32 blend_constant_amount(Mode const &mode)
+{
+    if constexpr (requires { mode.amount; }) { return mode.amount; } else { return 0; }
+}
+
+template <typename Mode>
+inline u32 blend_pixel(Mode const &mode, u32 src, u32 dst)
+{
+    u32 const a = src >> 24;
+
+    if (a == 0)
+    {
+        return dst;
+    }
+
+    u32 const k = blend_constant_color(mode);
+    u32 const t = blend_constant_amount(mode);
+    u32 res = 0xff000000;
+
+    for (u32 shift = 0; shift < 24; shift += 8)
+    {
+        u32 const s = (src >> shift) & 255;
+        u32 const d = (dst >> shift) & 255;
+        u32 const m = mode.mix(s, d, (k >> shift) & 255, t);
+        res |= (a == 255 ? m : (m * a + d * (255 - a)) >> 8) << shift;
+    }
+
+    return res;
+}
+
+template <typename Mode>
+inline pixel4 blend4(Mode const &mode, pixel4 src, pixel4 dst)
+{
+    v128_t const zero = wasm_i32x4_splat(0);
+    v128_t const full = wasm_u16x8_splat(255);
+    v128_t const k = wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat(blend_constant_color(mode)));
+    v128_t const t = wasm_u16x8_splat(blend_constant_amount(mode));
+
+    v128_t const alpha_lo = wasm_i8x16_shuffle(src.v, zero, 3, 16, 3, 16, 3, 16, 3, 16, 7, 16, 7, 16, 7, 16, 7, 16);
+    v128_t const alpha_hi = wasm_i8x16_shuffle(src.v, zero, 11, 16, 11, 16, 11, 16, 11, 16, 15, 16, 15, 16, 15, 16, 15, 16);
+
+    v128_t const dst_lo = wasm_u16x8_extend_low_u8x16(dst.v);
+    v128_t const dst_hi = wasm_u16x8_extend_high_u8x16(dst.v);
+    v128_t const mix_lo = mode.mix(wasm_u16x8_extend_low_u8x16(src.v), dst_lo, k, t);
+    v128_t const mix_hi = mode.mix(wasm_u16x8_extend_high_u8x16(src.v), dst_hi, k, t);
+
+    v128_t const lo = wasm_u16x8_shr(wasm_i16x8_add(
+        wasm_i16x8_mul(mix_lo, alpha_lo),
+        wasm_i16x8_mul(dst_lo, wasm_i16x8_sub(full, alpha_lo))), 8);
+    v128_t const hi = wasm_u16x8_shr(wasm_i16x8_add(
+        wasm_i16x8_mul(mix_hi, alpha_hi),
+        wasm_i16x8_mul(dst_hi, wasm_i16x8_sub(full, alpha_hi))), 8);
+
+    v128_t const opaque_alpha = wasm_i32x4_splat(0xff000000);
+    v128_t const faded = wasm_v128_or(wasm_u8x16_narrow_i16x8(lo, hi), opaque_alpha);
+    v128_t const mixed = wasm_v128_or(wasm_u8x16_narrow_i16x8(mix_lo, mix_hi), opaque_alpha);
+
+    v128_t const alpha = src.alpha();
+    v128_t const res = wasm_v128_bitselect(dst.v, faded, wasm_i32x4_eq(alpha, zero));
+    return { wasm_v128_bitselect(mixed, res, wasm_i32x4_eq(alpha, wasm_i32x4_splat(255))) };
+}
+
+/*source-over keeps its hand written kernel, the default path pays nothing for the others*/
+inline pixel4 blend4(blend_over const &, pixel4 src, pixel4 dst)
+{
+    return blend(src, dst);
+}
+
+enum class blend_kind : u32
+{
+    over,
+    add,
+    multiply,
+    screen,
+    tint,
+    /*source-over in linear light, see linear.hpp*/
+    linear_over,
+};
+
+/*picked per draw at runtime, dispatch() turns it into one of the kernels above once per blit*/
+struct blend_mode
+{
+    blend_kind kind = blend_kind::over;
+    u32 color = 0;
+    u32 amount = 0;
+};
+
+template <typename F>
+inline void dispatch(blend_mode const &mode, F &&f)
+{
+    switch (mode.kind)
+    {
+        case blend_kind::over: f(blend_over{}); break;
+        case blend_kind::add: f(blend_add{}); break;
+        case blend_kind::multiply: f(blend_multiply{}); break;
+        case blend_kind::screen: f(blend_screen{}); break;
+        case blend_kind::tint: f(blend_tint{ mode.color, mode.amount }); break;
+        case blend_kind::linear_over: f(blend_linear_over{}); break;
+    }
+}
+
+#endif /* BLEND */
@@ -1,12 +1,17 @@
 
 let context: CanvasRenderingContext2D;
 let module_instance: WebAssembly.Instance;
-let memory: WebAssembly.Memory = new WebAssembly.Memory({initial: 1000, maximum: 1000})
+const memoryMaxPages = 1000;
+let memory: WebAssembly.Memory = new WebAssembly.Memory({initial: memoryMaxPages, maximum: memoryMaxPages})
 let memoryView = new DataView(memory.buffer);
 
 let malloc: (size: number) => number;
 let zalloc: (size: number) => number;
-let free: (size: number) => void;
+let aligned_zalloc: (alignment: number, size: number) => number;
+let free: (ptr: number) => void;
+let walloc_stats: () => number;
+let walloc_walk: (out: number, capacity: number) => number;
+let teardown: () => void;
 
 let keystatePtr: number = 0;
 let keystateLen: number = 0;
@@ -43,13 +48,23 @@ async function update(timestamp: DOMHighResTimeStamp)
     const beg = Date.now();
 
     let on_frame: WebAssembly.ExportValue = module_instance.exports["on_frame"];
-    (on_frame as any)();
+    (on_frame as any)(timestamp);
     
     let src = new ImageData(new Uint8ClampedArray(memoryView.buffer).subarray(screenPtr, screenPtr + screenLen), context.canvas.width);
     let image = await createImageBitmap(src);
     context.drawImage(image, 0, 0, image.width, image.height);
     const end = Date.now();
     console.log("ms:", end - beg);
+
+    if (++frameCounter % heapCheckInterval == 0)
+    {
+        checkHeap();
+    }
+
+    if (wallocTrace.length > 0)
+    {
+        wallocTrace.push("frame");
+    }
 }
 
 let mouseX: number = 0;
@@ -62,23 +77,147 @@ function mouseXY()
 
 const page_size = 64*1024;
 
-let audio: HTMLAudioElement[] = new Array<HTMLAudioElement>(0x10);
+/*word order of struct walloc_stats in walloc.c, followed by the per size class arrays*/
+const heapStatsFields = [
+    "heap_start", "heap_pages", "grow_count", "grow_bytes",
+    "large_live_objects", "large_live_bytes", "free_large_objects", "free_large_bytes",
+    "largest_free_large_object", "fragmentation", "small_free_bytes", "small_object_kinds",
+];
+const heapCheckInterval = 300;
+const heapWarnPages = memoryMaxPages*0.9;
+let frameCounter = 0;
+
+function readHeapStats()
+{
+    const ptr = walloc_stats();
+    const word = (i: number) => memoryView.getUint32(ptr + i*4, true);
+
+    const stats: {[field: string]: number} = {};
+    heapStatsFields.forEach((field, i) => stats[field] = word(i));
+
+    const kinds = stats["small_object_kinds"];
+    const smallLiveBytes = new Map<number, number>();
+    for (let i = 0; i < kinds; ++i)
+    {
+        smallLiveBytes.set(word(heapStatsFields.length + i), word(heapStatsFields.length + kinds + i));
+    }
+
+    return {stats, smallLiveBytes};
+}
+
+/*struct walloc_chunk_info is start, size, kind and object_size*/
+function logHeapWalk()
+{
+    /*the record buffer is itself allocated, which can add a record or two*/
+    const capacity = walloc_walk(0, 0) + 16;
+    const ptr = malloc(capacity*16);
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    const count = Math.min(walloc_walk(ptr, capacity), capacity);
+    const bytesByKind = new Map<string, number>();
+
+    for (let i = 0; i < count; ++i)
+    {
+        const size = memoryView.getUint32(ptr + i*16 + 4, true);
+        const kind = memoryView.getUint32(ptr + i*16 + 8, true);
+        const objectSize = memoryView.getUint32(ptr + i*16 + 12, true);
+        const name = kind == 254 ? "free large objects" : kind == 255 ? "large objects" : objectSize + " byte objects";
+
+        bytesByKind.set(name, (bytesByKind.get(name) ?? 0) + size);
+    }
+
+    free(ptr);
+    console.warn("heap by chunk kind:", bytesByKind);
+}
+
+/*
+    filled when main.wasm is built with -DWALLOC_TRACE, addresses are turned
+    into object ids so the trace replays on any heap layout in bench/walloc_bench
+*/
+let wallocTrace: string[] = [];
+let wallocTraceIds = new Map<number, number>();
+let wallocTraceNextId = 1;
+
+function walloc_trace(op: number, ptr: number, size: number)
+{
+    switch (String.fromCharCode(op))
+    {
+        case "a":
+        {
+            const id = wallocTraceNextId++;
+            wallocTraceIds.set(ptr, id);
+            wallocTrace.push(`a ${id} ${size}`);
+            break;
+        }
+        case "f":
+        {
+            const id = wallocTraceIds.get(ptr);
+            if (id != undefined)
+            {
+                wallocTraceIds.delete(ptr);
+                wallocTrace.push(`f ${id}`);
+            }
+            break;
+        }
+        case "r":
+        {
+            const id = wallocTraceIds.get(ptr);
+            if (id != undefined)
+            {
+                wallocTrace.push(`r ${id} ${size}`);
+            }
+            break;
+        }
+    }
+}
+
+function saveWallocTrace()
+{
+    const link = document.createElement("a");
+    link.href = URL.createObjectURL(new Blob([wallocTrace.join("\n") + "\n"], {type: "text/plain"}));
+    link.download = "walloc.trace";
+    link.click();
+    URL.revokeObjectURL(link.href);
+}
+
+(window as any).saveWallocTrace = saveWallocTrace;
+
+function checkHeap()
+{
+    const {stats, smallLiveBytes} = readHeapStats();
+    const freeBytes = stats["free_large_bytes"] + stats["small_free_bytes"];
+    const usedPages = stats["heap_start"]/page_size + stats["heap_pages"] - freeBytes/page_size;
+
+    if (usedPages > heapWarnPages)
+    {
+        console.warn("heap uses", Math.ceil(usedPages), "of", memoryMaxPages, "pages", stats, smallLiveBytes);
+        logHeapWalk();
+    }
+}
+
+let audio: (HTMLAudioElement | undefined)[] = [];
+let audioTracks: (MediaElementAudioSourceNode | undefined)[] = [];
+let audioFreeIds: number[] = [];
 let audio_count = 0;
 
 function playAudio(id: number, loop: boolean)
 {
-    audio[id].loop = loop;
-    audio[id].play();
+    (audio[id] as HTMLAudioElement).loop = loop;
+    (audio[id] as HTMLAudioElement).play();
 }
 
 function pauseAudio(id: number)
 {
-    audio[id].pause();
+    (audio[id] as HTMLAudioElement).pause();
 }
 
 function audioSetVolume(id: number, level: number)
 {
-    audio[id].volume = level;
+    (audio[id] as HTMLAudioElement).volume = level;
 }
 
 function request_audio(uri_ptr: number, uri_len: number)
@@ -93,17 +232,33 @@ function request_audio(uri_ptr: number, uri_len: number)
     const track = audioContext.createMediaElementSource(audioElement);
     track.connect(audioContext.destination);
 
-    const res = audio_count++;
+    const res = audioFreeIds.length > 0 ? audioFreeIds.pop() as number : audio_count++;
     audio[res] = audioElement;
+    audioTracks[res] = track;
 
     return res;
 }
 
-let imagePtrs: number[] = new Array<number>(0x100);
-let images: HTMLImageElement[] = new Array<HTMLImageElement>(0x100);
-let imageState: boolean[] = new Array<boolean>(0x100);
-let imageWidth: number[] = new Array<number>(0x100);
-let imageHeight: number[] = new Array<number>(0x100);
+function release_audio(id: number)
+{
+    const audioElement = audio[id] as HTMLAudioElement;
+    audioElement.pause();
+    audioElement.removeAttribute("src");
+    audioElement.load();
+
+    (audioTracks[id] as MediaElementAudioSourceNode).disconnect();
+
+    audio[id] = undefined;
+    audioTracks[id] = undefined;
+    audioFreeIds.push(id);
+}
+
+let imagePtrs: number[] = [];
+let images: (HTMLImageElement | undefined)[] = [];
+let imageState: boolean[] = [];
+let imageWidth: number[] = [];
+let imageHeight: number[] = [];
+let imageFreeIds: number[] = [];
 let images_count = 0;
 
 function request_image(uri_ptr: number, uri_len: number)
@@ -112,28 +267,45 @@ function request_image(uri_ptr: number, uri_len: number)
 
     console.log(uri);
 
-    const res = images_count++;
-    images[res] = new Image();
+    const res = imageFreeIds.length > 0 ? imageFreeIds.pop() as number : images_count++;
+    const imageElement = new Image();
+    images[res] = imageElement;
     
     imageState[res] = false;
-    images[res].src = uri;
+    imagePtrs[res] = 0;
+    imageElement.src = uri;
 
     return res;
 }
 
+function release_image(id: number)
+{
+    if (imageState[id])
+    {
+        free(imagePtrs[id]);
+    }
+
+    images[id] = undefined;
+    imageState[id] = false;
+    imagePtrs[id] = 0;
+    imageFreeIds.push(id);
+}
+
 function image_ready(res: number)
 {
-    if (!imageState[res] && images[res].complete)
+    const imageElement = images[res];
+
+    if (!imageState[res] && imageElement && imageElement.complete)
     {
         let imageCanvas = document.createElement("canvas") as HTMLCanvasElement;
-        imageCanvas.width = images[res].width;
-        imageCanvas.height = images[res].height;
+        imageCanvas.width = imageElement.width;
+        imageCanvas.height = imageElement.height;
         imageWidth[res] = imageCanvas.width; 
         imageHeight[res] = imageCanvas.height; 
         console.log(imageCanvas.width, imageCanvas.height);
 
         let imageCanvasContext = imageCanvas.getContext("2d") as CanvasRenderingContext2D;
-        imageCanvasContext.drawImage(images[res], 0, 0);
+        imageCanvasContext.drawImage(imageElement, 0, 0);
         let imageData: Uint8ClampedArray = imageCanvasContext.getImageData(0, 0, imageCanvas.width, imageCanvas.height).data;
 
         imagePtrs[res] = malloc(imageData.length);
@@ -145,7 +317,7 @@ function image_ready(res: number)
             memoryView.setUint8(imagePtrs[res] + i, imageData[i]);
         }
 
-        delete images[res];
+        images[res] = undefined;
         
         imageState[res] = true;
     }
@@ -350,21 +522,21 @@ async function main()
                 "cosf": (arg: number) => Math.cos(arg), 
                 "acosf": (arg: number) => Math.acos(arg),
                 "asinf": (arg: number) => Math.asin(arg),
-                "sqrtf": (arg: number) => Math.sqrt(arg),
-                "sqrti": (arg: number) => Math.sqrt(arg),
-                "floor": (arg: number) => Math.floor(arg),
-                "ceil": (arg: number) => Math.ceil(arg),
-                "mod": (arg0: number, arg1: number) => arg0 % arg1,
                 "cursor_xy": () => mouseXY(),
+                "time_ms": () => performance.now(),
                 
                 "request_image": (ptr: number, len: number) => request_image(ptr, len),
                 "image_ready": (arg: number) => image_ready(arg),
                 "get_image": (arg: number) => get_image(arg),
+                "release_image": (arg: number) => release_image(arg),
                 
                 "request_audio": (ptr: number, len: number) => request_audio(ptr, len),
                 "audio_play": (id: number, loop: boolean) => playAudio(id, loop),
                 "audio_pause": (id: number) => pauseAudio(id),
                 "audio_set_volume": (id: number, level: number) => audioSetVolume(id, level),
+                "release_audio": (id: number) => release_audio(id),
+
+                "walloc_trace": (op: number, ptr: number, size: number) => walloc_trace(op, ptr, size),
 
                 "print_i32": (arg: number) => console.log(arg), 
                 "print_i32_array": (arg0: number, arg1: number) => console.log(new Int32Array(memory.buffer).subarray(arg1/4, arg1/4 + arg0)), 
@@ -386,7 +558,11 @@ async function main()
         module_instance = await WebAssembly.instantiate(module, wasm_imports);
         malloc = module_instance.exports["malloc"] as (size: number) => number;
         zalloc = module_instance.exports["zalloc"] as (size: number) => number;
-        free = module_instance.exports["free"] as (size: number) => number;
+        aligned_zalloc = module_instance.exports["aligned_zalloc"] as (alignment: number, size: number) => number;
+        free = module_instance.exports["free"] as (ptr: number) => void;
+        walloc_stats = module_instance.exports["walloc_stats"] as () => number;
+        walloc_walk = module_instance.exports["walloc_walk"] as (out: number, capacity: number) => number;
+        teardown = module_instance.exports["teardown"] as () => void;
 
         {
             const len = 512;
@@ -405,8 +581,9 @@ async function main()
         }
 
         {
+            /*cache line aligned so the v128 stores in the blitters never straddle lines*/
             const len = canvas.width*canvas.height*4;
-            const ptr = zalloc(len);
+            const ptr = aligned_zalloc(64, len);
 
             screenPtr = ptr;
             screenLen = len;
@@ -423,6 +600,7 @@ async function main()
 
         if(e)
         {
+            teardown();
             free(screenPtr);
             free(keystatePtr);
         }
@@ -22,6 +22,9 @@ class string_param
     size_t len;
 public:
     constexpr string_param(char const *str) : ptr(str), len(strlen(str)) {}
+
+    constexpr char const *data() const { return ptr; }
+    constexpr size_t size() const { return len; }
 };
 
 template <typename A, typename B>
@@ -33,17 +36,50 @@ struct pair
 
 struct image { u32 *data; i32 w, h; };
 
+/*
+    a rectangle of pixels owned by someone else, rows stride pixels apart.
+    a whole image, an atlas entry, a frame of a sprite sheet or a region of
+    the framebuffer are all views, so blits take them without copying
+*/
+struct image_view
+{
+    u32 *data;
+    i32 w, h;
+    i32 stride;
+
+    constexpr image_view() : data(nullptr), w(0), h(0), stride(0) {}
+    constexpr image_view(u32 *data, i32 w, i32 h, i32 stride) : data(data), w(w), h(h), stride(stride) {}
+    constexpr image_view(image const &img) : data(img.data), w(img.w), h(img.h), stride(img.w) {}
+
+    constexpr u32 *row(i32 y) const { return data + y * stride; }
+
+    /*clipped to this view, an empty rectangle gives an empty view*/
+    constexpr image_view sub(i32 x, i32 y, i32 sw, i32 sh) const
+    {
+        i32 const x0 = x < 0 ? 0 : x > w ? w : x;
+        i32 const y0 = y < 0 ? 0 : y > h ? h : y;
+        i32 const x1 = x + sw < x0 ? x0 : x + sw > w ? w : x + sw;
+        i32 const y1 = y + sh < y0 ? y0 : y + sh > h ? h : y + sh;
+        return { data + y0 * stride + x0, x1 - x0, y1 - y0, stride };
+    }
+};
+
 [[clang::import_name("is_focused")]] vec2i is_focused();
 
+/*milliseconds from an arbitrary start, sub millisecond where the host allows*/
+[[clang::import_name("time_ms")]] f64 time_ms();
+
 [[clang::import_name("request_image")]] i32 request_image(string_param uri);
 [[clang::import_name("image_ready")]] bool image_ready(i32 id);
 [[clang::import_name("get_image")]] image get_image(i32 id);
+[[clang::import_name("release_image")]] void release_image(i32 id);
 
 [[clang::import_name("request_audio")]] i32 request_audio(string_param uri);
 [[clang::import_name("audio_play")]] i32 audio_play(i32 id, bool loop = false);
 [[clang::import_name("audio_pause")]] i32 audio_pause(i32 id);
 [[clang::import_name("audio_resume")]] i32 audio_resume(i32 id);
 [[clang::import_name("audio_set_volume")]] void audio_set_volume(i32 id, f32 level);
+[[clang::import_name("release_audio")]] void release_audio(i32 id);
 
 [[clang::import_name("cursor_inside")]] bool cursor_inside();
 [[clang::import_name("cursor_xy")]] vec2i cursor_xy();
@@ -0,0 +1,198 @@
+#ifndef LIGHT
+#define LIGHT
+#include "wasmdefs.hpp"
+#include "math.hpp"
+
+/*
+    light accumulated at a fraction of the screen resolution, 1 << shift
+    screen pixels to a cell each way. a cell is four u16 lanes, rgb and an
+    unused one, where 128 leaves a colour as it is and 255 almost doubles
+    it. cell (i, j) is the light at screen pixel (i << shift, j << shift),
+    there is one extra column and row so every pixel has cells on both sides
+
+    lights are splatted additively, touching only the cells they cover, so
+    a light costs its area in cells. the screen reads the buffer through
+    row(), one bilinear row of cells per screen row, and lerps between two
+    cells per pair of pixels, see post.hpp
+*/
+struct light_buffer
+{
+    u16 *cells = nullptr;
+    u16 *scratch = nullptr;
+    i32 w = 0, h = 0;
+    u32 shift = 0;
+
+    /*per pair of pixels in a block of cells, q15 weights toward the next cell*/
+    v128_t fracs[4] = {};
+
+    u16 *cell(i32 x, i32 y) const { return cells + (y * w + x) * 4; }
+};
+
+namespace light
+{
+    constexpr u32 neutral = 128;
+
+    /*for a screen of screen_w by screen_h at 1 / (1 << shift), shift 2 or 3, false if there was no memory*/
+    static bool resize(light_buffer &lb, i32 screen_w, i32 screen_h, u32 shift)
+    {
+        i32 const w = (screen_w >> shift) + 2;
+        i32 const h = (screen_h >> shift) + 2;
+
+        if (lb.cells && lb.w == w && lb.h == h && lb.shift == shift)
+        {
+            return true;
+        }
+
+        free(lb.cells);
+        free(lb.scratch);
+        lb = {};
+
+        /*whole pairs of cells with at least one to spare, row() works eight lanes at a time*/
+        size_t const cell_count = (static_cast<size_t>(w) * h + 2) & ~size_t(1);
+        size_t const scratch_count = (static_cast<size_t>(w) + 2) & ~size_t(1);
+        u16 *const cells = reinterpret_cast<u16*>(aligned_alloc(16, cell_count * 4 * sizeof(u16)));
+        u16 *const scratch = reinterpret_cast<u16*>(aligned_alloc(16, scratch_count * 4 * sizeof(u16)));
+
+        if (!cells || !scratch)
+        {
+            free(cells);
+            free(scratch);
+            return false;
+        }
+
+        lb.cells = cells;
+        lb.scratch = scratch;
+        lb.w = w;
+        lb.h = h;
+        lb.shift = shift;
+
+        for (u32 j = 0; j < (1u << shift); j += 2)
+        {
+            i16 const f0 = static_cast<i16>(j << (15 - shift));
+            i16 const f1 = static_cast<i16>((j + 1) << (15 - shift));
+            lb.fracs[j >> 1] = wasm_i16x8_make(f0, f0, f0, f0, f1, f1, f1, f1);
+        }
+
+        return true;
+    }
+
+    /*sets every cell to ambient, a colour where each channel of 128 is neutral*/
+    static void clear(light_buffer const &lb, u32 ambient)
+    {
+        u16 const r = static_cast<u16>((ambient >> 0) & 255);
+        u16 const g = static_cast<u16>((ambient >> 8) & 255);
+        u16 const b = static_cast<u16>((ambient >> 16) & 255);
+        v128_t const pair = wasm_i16x8_make(r, g, b, 0, r, g, b, 0);
+        i32 const count = lb.w * lb.h;
+        i32 i = 0;
+
+        for (; i + 2 <= count; i += 2)
+        {
+            wasm_v128_store(lb.cells + i * 4, pair);
+        }
+
+        if (i < count)
+        {
+            wasm_v128_store64_lane(lb.cells + i * 4, pair, 0);
+        }
+    }
+
+    /*
+        adds color, scaled by intensity where 1 adds neutral, to the cells
+        within radius screen pixels of center, falling off as (1 - d^2/r^2)^2
+    */
+    static void splat(light_buffer const &lb, vec2f center, f32 radius, u32 color, f32 intensity)
+    {
+        f32 const scale = 1.f / (1u << lb.shift);
+        f32 const cx = center.x * scale;
+        f32 const cy = center.y * scale;
+        f32 const r = radius * scale;
+
+        i32 const x0 = math::max(static_cast<i32>(math::ceil(cx - r)), 0);
+        i32 const y0 = math::max(static_cast<i32>(math::ceil(cy - r)), 0);
+        i32 const x1 = math::min(static_cast<i32>(math::floor(cx + r)) + 1, lb.w);
+        i32 const y1 = math::min(static_cast<i32>(math::floor(cy + r)) + 1, lb.h);
+
+        if (r <= 0.f || x0 >= x1 || y0 >= y1)
+        {
+            return;
+        }
+
+        f32 const k = intensity * neutral / 255.f;
+        i16 const kr = static_cast<i16>(math::min(((color >> 0) & 255) * k, 32767.f));
+        i16 const kg = static_cast<i16>(math::min(((color >> 8) & 255) * k, 32767.f));
+        i16 const kb = static_cast<i16>(math::min(((color >> 16) & 255) * k, 32767.f));
+        v128_t const tint = wasm_i16x8_make(kr, kg, kb, 0, kr, kg, kb, 0);
+        f32 const inv_r2 = 1.f / (r * r);
+
+        auto const falloff = [&](i32 x, f32 dy2) {
+            f32 const dx = x - cx;
+            f32 const t = math::max(1.f - (dx * dx + dy2) * inv_r2, 0.f);
+            return static_cast<i16>(t * t * 32767.f);
+        };
+
+        for (i32 y = y0; y < y1; ++y)
+        {
+            f32 const dy2 = (y - cy) * (y - cy);
+            u16 *const row = lb.cell(0, y);
+            i32 x = x0;
+
+            for (; x + 2 <= x1; x += 2)
+            {
+                i16 const f0 = falloff(x, dy2);
+                i16 const f1 = falloff(x + 1, dy2);
+                v128_t const add = wasm_i16x8_q15mulr_sat(tint, wasm_i16x8_make(f0, f0, f0, f0, f1, f1, f1, f1));
+                wasm_v128_store(row + x * 4, wasm_u16x8_add_sat(wasm_v128_load(row + x * 4), add));
+            }
+
+            if (x < x1)
+            {
+                i16 const f = falloff(x, dy2);
+                v128_t const add = wasm_i16x8_q15mulr_sat(tint, wasm_i16x8_make(f, f, f, f, 0, 0, 0, 0));
+                wasm_v128_store64_lane(row + x * 4, wasm_u16x8_add_sat(wasm_v128_load64_zero(row + x * 4), add), 0);
+            }
+        }
+    }
+
+    /*the cells for screen row y, lerped between the two cell rows around it and clamped to 255*/
+    static u16 const *row(light_buffer const &lb, i32 y)
+    {
+        i32 const j = y >> lb.shift;
+        i16 const f = static_cast<i16>((y & ((1 << lb.shift) - 1)) << (15 - lb.shift));
+        v128_t const frac = wasm_i16x8_splat(f);
+        v128_t const top = wasm_u16x8_splat(255);
+        u16 const *const a = lb.cell(0, j);
+        u16 const *const b = lb.cell(0, j + 1);
+        i32 const count = lb.w * 4;
+
+        /*q15 lerps are signed, so the cells are clamped before, not after*/
+        for (i32 i = 0; i < count; i += 8)
+        {
+            v128_t const va = wasm_u16x8_min(wasm_v128_load(a + i), top);
+            v128_t const vb = wasm_u16x8_min(wasm_v128_load(b + i), top);
+            wasm_v128_store(lb.scratch + i, wasm_i16x8_add(va, wasm_i16x8_q15mulr_sat(wasm_i16x8_sub(vb, va), frac)));
+        }
+
+        return lb.scratch;
+    }
+
+    /*the light of pixels x and x + 1 of a row(), x even*/
+    inline v128_t pair(light_buffer const &lb, u16 const *cells, i32 x)
+    {
+        u16 const *const a = cells + (x >> lb.shift) * 4;
+        v128_t const va = wasm_v128_load64_splat(a);
+        v128_t const vb = wasm_v128_load64_splat(a + 4);
+        v128_t const frac = lb.fracs[(x & ((1 << lb.shift) - 1)) >> 1];
+        return wasm_i16x8_add(va, wasm_i16x8_q15mulr_sat(wasm_i16x8_sub(vb, va), frac));
+    }
+
+    /*the same for a single pixel, one channel*/
+    inline u32 single(light_buffer const &lb, u16 const *cells, i32 x, u32 channel)
+    {
+        u16 const *const a = cells + (x >> lb.shift) * 4;
+        i32 const frac = (x & ((1 << lb.shift) - 1)) << (15 - lb.shift);
+        return a[channel] + (((a[channel + 4] - a[channel]) * frac + (1 << 14)) >> 15);
+    }
+}
+
+#endif /* LIGHT */
@@ -0,0 +1,262 @@
+#ifndef LINEAR
+#define LINEAR
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "imports.hpp"
+
+/*
+    gamma correct compositing. sprites and the framebuffer hold srgb bytes,
+    and mixing those directly makes every translucent edge too dark. here a
+    channel goes through a 256 entry table to linear light on read, is mixed
+    in i16x8 lanes with a q15 multiply, two pixels at a time, and goes back
+    through a 4096 entry table on write
+
+    linear light is 15 bits so the q15 multiply scales it directly, the
+    encode table is indexed by its top 12 bits. that is still finer than the
+    srgb steps near black, and init() makes sure every byte decodes and
+    encodes back to itself, so pixels a blend leaves alone do not drift
+*/
+namespace linear
+{
+    constexpr u32 bits = 15;
+    constexpr u32 one = (1u << bits) - 1;
+    constexpr u32 encode_bits = 12;
+
+    struct tables_type
+    {
+        u16 to_linear[256];
+        u8 to_srgb[1u << encode_bits];
+    };
+
+    static tables_type tables;
+
+    /*fills the tables, call once before any linear blending*/
+    static void init()
+    {
+        for (u32 i = 0; i < 256; ++i)
+        {
+            f64 const c = i / 255.;
+            f64 const l = c <= .04045 ? c / 12.92 : math::pow((c + .055) / 1.055, 2.4);
+            tables.to_linear[i] = static_cast<u16>(l * one + .5);
+        }
+
+        constexpr u32 shift = bits - encode_bits;
+
+        for (u32 i = 0; i < (1u << encode_bits); ++i)
+        {
+            /*the middle of the range of linear values that share this entry*/
+            f64 const l = ((i << shift) + (1u << shift) * .5) / one;
+            f64 const c = l <= .0031308 ? l * 12.92 : 1.055 * math::pow(l, 1. / 2.4) - .055;
+            tables.to_srgb[i] = static_cast<u8>(math::min(c, 1.) * 255. + .5);
+        }
+
+        for (u32 i = 0; i < 256; ++i)
+        {
+            tables.to_srgb[tables.to_linear[i] >> shift] = static_cast<u8>(i);
+        }
+    }
+
+    inline u32 decode(u32 col, u32 shift)
+    {
+        return tables.to_linear[(col >> shift) & 255];
+    }
+
+    inline u32 encode(u32 l)
+    {
+        return tables.to_srgb[l >> (bits - encode_bits)];
+    }
+
+    inline u32 encode(u32 r, u32 g, u32 b)
+    {
+        return encode(r) | (encode(g) << 8) | (encode(b) << 16) | 0xff000000;
+    }
+
+    /*two pixels as eight lanes, rgb in linear light and alpha left as it was*/
+    inline v128_t decode2(u32 p0, u32 p1)
+    {
+        return wasm_i16x8_make(
+            decode(p0, 0), decode(p0, 8), decode(p0, 16), p0 >> 24,
+            decode(p1, 0), decode(p1, 8), decode(p1, 16), p1 >> 24);
+    }
+
+    inline u32 encode_lo(v128_t v)
+    {
+        return encode(wasm_u16x8_extract_lane(v, 0), wasm_u16x8_extract_lane(v, 1), wasm_u16x8_extract_lane(v, 2));
+    }
+
+    inline u32 encode_hi(v128_t v)
+    {
+        return encode(wasm_u16x8_extract_lane(v, 4), wasm_u16x8_extract_lane(v, 5), wasm_u16x8_extract_lane(v, 6));
+    }
+
+    /*alpha out of 255 as a q15 factor, 255 maps to the largest one there is*/
+    inline i32 alpha_q15(u32 a)
+    {
+        return (a << 7) + (a >> 1);
+    }
+
+    inline u32 mix(u32 s, u32 d, i32 a15)
+    {
+        return d + ((static_cast<i32>(s - d) * a15 + (1 << 14)) >> 15);
+    }
+
+    /*d + (s - d)*a on two decoded pixels, a from the alpha lanes of s*/
+    inline v128_t over2(v128_t s, v128_t d)
+    {
+        v128_t const a = wasm_i16x8_shuffle(s, s, 3, 3, 3, 3, 7, 7, 7, 7);
+        v128_t const a15 = wasm_i16x8_add(wasm_i16x8_shl(a, 7), wasm_u16x8_shr(a, 1));
+        return wasm_i16x8_add(d, wasm_i16x8_q15mulr_sat(wasm_i16x8_sub(s, d), a15));
+    }
+}
+
+/*source-over in linear light onto an srgb destination*/
+struct blend_linear_over {};
+
+inline u32 blend_pixel(blend_linear_over const &, u32 src, u32 dst)
+{
+    u32 const a = src >> 24;
+
+    if (a == 0)
+    {
+        return dst;
+    }
+
+    if (a == 255)
+    {
+        return src;
+    }
+
+    i32 const a15 = linear::alpha_q15(a);
+
+    return linear::encode(
+        linear::mix(linear::decode(src, 0), linear::decode(dst, 0), a15),
+        linear::mix(linear::decode(src, 8), linear::decode(dst, 8), a15),
+        linear::mix(linear::decode(src, 16), linear::decode(dst, 16), a15));
+}
+
+inline pixel4 blend4(blend_linear_over const &, pixel4 src, pixel4 dst)
+{
+    u32 s[4];
+    u32 d[4];
+    src.store(s);
+    dst.store(d);
+
+    v128_t const lo = linear::over2(linear::decode2(s[0], s[1]), linear::decode2(d[0], d[1]));
+    v128_t const hi = linear::over2(linear::decode2(s[2], s[3]), linear::decode2(d[2], d[3]));
+    v128_t const mixed = wasm_i32x4_make(linear::encode_lo(lo), linear::encode_hi(lo), linear::encode_lo(hi), linear::encode_hi(hi));
+
+    v128_t const alpha = src.alpha();
+    v128_t const res = wasm_v128_bitselect(dst.v, mixed, wasm_i32x4_eq(alpha, wasm_i32x4_splat(0)));
+    return { wasm_v128_bitselect(src.v, res, wasm_i32x4_eq(alpha, wasm_i32x4_splat(255))) };
+}
+
+/*
+    the other place the blended result can live: four u16 per pixel, rgb in
+    linear light, twice the bytes of the framebuffer. blits onto it decode
+    only their source, the destination is never converted until resolve()
+    encodes the finished frame once
+*/
+struct linear_target
+{
+    u16 *data = nullptr;
+    i32 w = 0, h = 0;
+
+    u16 *row(i32 y) const { return data + y * w * 4; }
+};
+
+namespace linear
+{
+    /*false if there was no memory for it, target stays empty then*/
+    static bool resize(linear_target &target, i32 w, i32 h)
+    {
+        if (target.data && target.w == w && target.h == h)
+        {
+            return true;
+        }
+
+        free(target.data);
+        target = {};
+
+        u16 *const data = reinterpret_cast<u16*>(aligned_alloc(16, static_cast<size_t>(w) * h * 4 * sizeof(u16)));
+
+        if (!data)
+        {
+            return false;
+        }
+
+        target = { data, w, h };
+        return true;
+    }
+
+    static void fill(linear_target const &target, u32 col)
+    {
+        v128_t const pair = decode2(col, col);
+        i32 const count = target.w * target.h;
+        i32 i = 0;
+
+        for (; i + 2 <= count; i += 2)
+        {
+            wasm_v128_store(target.data + i * 4, pair);
+        }
+
+        if (i < count)
+        {
+            wasm_v128_store64_lane(target.data + i * 4, pair, 0);
+        }
+    }
+
+    /*source-over of span srgb pixels onto a row of the target, mirrored reads src leftwards*/
+    template <bool mirrored>
+    static void blend_row(u16 *dst, u32 const *src, i32 span)
+    {
+        i32 i = 0;
+
+        for (; i + 2 <= span; i += 2)
+        {
+            u32 const p0 = mirrored ? src[-i] : src[i];
+            u32 const p1 = mirrored ? src[-i - 1] : src[i + 1];
+            u32 const a = (p0 & p1) >> 24;
+
+            if (((p0 | p1) >> 24) == 0)
+            {
+                continue;
+            }
+
+            v128_t const s = decode2(p0, p1);
+            wasm_v128_store(dst + i * 4, a == 255 ? s : over2(s, wasm_v128_load(dst + i * 4)));
+        }
+
+        if (i < span)
+        {
+            u32 const p = mirrored ? src[-i] : src[i];
+            u32 const a = p >> 24;
+            u16 *const d = dst + i * 4;
+
+            if (a != 0)
+            {
+                i32 const a15 = alpha_q15(a);
+                d[0] = static_cast<u16>(mix(decode(p, 0), d[0], a15));
+                d[1] = static_cast<u16>(mix(decode(p, 8), d[1], a15));
+                d[2] = static_cast<u16>(mix(decode(p, 16), d[2], a15));
+            }
+        }
+    }
+
+    /*encodes the target onto dst, which is the same size*/
+    static void resolve(image_view const &dst, linear_target const &src)
+    {
+        for (i32 y = 0; y < src.h; ++y)
+        {
+            u16 const *const src_row = src.row(y);
+            u32 *const dst_row = dst.row(y);
+
+            for (i32 x = 0; x < src.w; ++x)
+            {
+                u16 const *const p = src_row + x * 4;
+                dst_row[x] = encode(p[0], p[1], p[2]);
+            }
+        }
+    }
+}
+
+#endif /* LINEAR */
@@ -0,0 +1,88 @@
+#ifndef LUT
+#define LUT
+#include "wasmdefs.hpp"
+#include "imports.hpp"
+
+/*
+    per channel colour grading, one 256 entry table per channel with alpha
+    passed through. the builders are constexpr, so a grade known up front is
+    a table in the data section rather than work at startup
+*/
+struct color_lut
+{
+    u8 r[256];
+    u8 g[256];
+    u8 b[256];
+
+    static constexpr color_lut identity()
+    {
+        color_lut res{};
+
+        for (u32 i = 0; i < 256; ++i)
+        {
+            res.r[i] = res.g[i] = res.b[i] = static_cast<u8>(i);
+        }
+
+        return res;
+    }
+
+    /*every channel pulled toward color by amount out of 255, rounded like blend_tint*/
+    static constexpr color_lut fog(u32 color, u32 amount)
+    {
+        color_lut res{};
+        u32 const keep = 255 - amount;
+
+        for (u32 i = 0; i < 256; ++i)
+        {
+            res.r[i] = static_cast<u8>((i * keep + ((color >>  0) & 255) * amount + 255) >> 8);
+            res.g[i] = static_cast<u8>((i * keep + ((color >>  8) & 255) * amount + 255) >> 8);
+            res.b[i] = static_cast<u8>((i * keep + ((color >> 16) & 255) * amount + 255) >> 8);
+        }
+
+        return res;
+    }
+
+    /*this grade applied on top of first*/
+    constexpr color_lut after(color_lut const &first) const
+    {
+        color_lut res{};
+
+        for (u32 i = 0; i < 256; ++i)
+        {
+            res.r[i] = r[first.r[i]];
+            res.g[i] = g[first.g[i]];
+            res.b[i] = b[first.b[i]];
+        }
+
+        return res;
+    }
+
+    constexpr u32 apply(u32 col) const
+    {
+        return
+            (static_cast<u32>(r[(col >>  0) & 255]) <<  0) |
+            (static_cast<u32>(g[(col >>  8) & 255]) <<  8) |
+            (static_cast<u32>(b[(col >> 16) & 255]) << 16) |
+            (col & 0xff000000);
+    }
+};
+
+/*
+    grades a static surface once so drawing it later costs nothing extra.
+    dst and src are the same size and may be the same pixels
+*/
+static void bake(image_view const &dst, image_view const &src, color_lut const &lut)
+{
+    for (i32 y = 0; y < src.h; ++y)
+    {
+        u32 const *const src_row = src.row(y);
+        u32 *const dst_row = dst.row(y);
+
+        for (i32 x = 0; x < src.w; ++x)
+        {
+            dst_row[x] = lut.apply(src_row[x]);
+        }
+    }
+}
+
+#endif /* LUT */
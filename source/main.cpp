@@ -2,17 +2,32 @@
 #include "keycodes.hpp"
 #include "math.hpp"
 #include "imports.hpp"
-
-extern "C" {
-    void* malloc(size_t size);
-    void free(void *ptr);
-}
+#include "resources.hpp"
+#include "arena.hpp"
+#include "pool.hpp"
+#include "atlas.hpp"
+#include "blend.hpp"
+#include "lut.hpp"
+#include "post.hpp"
+#include "particles.hpp"
+#include "animation.hpp"
 
 [[clang::export_name("zalloc")]]
 void *zalloc(size_t size)
 {
-    void *ptr = malloc(size);
-    memset(ptr, 0, size);
+    return calloc(1, size);
+}
+
+[[clang::export_name("aligned_zalloc")]]
+void *aligned_zalloc(size_t alignment, size_t size)
+{
+    void *ptr = aligned_alloc(alignment, size);
+
+    if (ptr)
+    {
+        memset(ptr, 0, size);
+    }
+
     return ptr;
 }
 
@@ -33,22 +48,25 @@ static constexpr u32 rgba(u32 r, u32 g, u32 b, u32 a)
 
 struct rgba8_type 
 {
-    u32 r, g, b, a;
+    u8 r, g, b, a;
 };
 
 static constexpr rgba8_type unpack_rgba8(u32 col)
 {
     return {
-        ((col >>  0) & 255),
-        ((col >>  8) & 255),
-        ((col >> 16) & 255),
-        ((col >> 24) & 255)
+        static_cast<u8>(col >>  0),
+        static_cast<u8>(col >>  8),
+        static_cast<u8>(col >> 16),
+        static_cast<u8>(col >> 24)
     };
 }
 
+static arena frame_arena;
+
 static vec2i screen_size;
 static u32 screen_buffer_len;
 static u32* screen_buffer;
+static image_view screen;
 
 static void test_animation()
 {
@@ -102,68 +120,323 @@ static u32 blend(u32 src0, u32 src1)
     return rgba(nRed, nGreen, nBlue, 0xff);
 }
 
-static void draw_sprite(u32 dstw, u32 dsth, u32 *dst, image const &src, vec2i offset, i32 upscale)
+/*row tails of source-over stay on the plain scalar blend*/
+static u32 blend_pixel(blend_over const &, u32 src, u32 dst)
+{
+    return blend(src, dst);
+}
+
+constexpr u32 blit_flip_x = 1 << 0;
+constexpr u32 blit_flip_y = 1 << 1;
+
+/*everything about a draw_sprite call beyond where and how big*/
+struct sprite_style
+{
+    u32 flags = 0;
+    blend_mode blend = {};
+    /*graded while the source row is expanded, for grades that change; bake() static ones*/
+    color_lut const *lut = nullptr;
+};
+
+/*
+    blends span pixels from src onto dst_row with mode. mirrored reads src
+    leftwards from src[0], reversing every four pixels with a single lane
+    shuffle, so a flipped row costs what a plain one does
+*/
+template <bool mirrored, typename Mode>
+static void blend_row(Mode const &mode, u32 *dst_row, u32 const *src, i32 span)
 {
-    for (i32 j = 0; j < src.h*upscale; ++j)
+    i32 i = 0;
+
+    for (; i + 4 <= span; i += 4)
     {
-        for (i32 i = 0; i < src.w*upscale; ++i)
+        pixel4 texels;
+
+        if constexpr (mirrored)
+        {
+            v128_t const run = wasm_v128_load(src - i - 3);
+            texels = { wasm_i32x4_shuffle(run, run, 3, 2, 1, 0) };
+        }
+        else
         {
-            i32 const src_index = j/upscale * src.w + i/upscale;
-            
-            i32 const dstx = i + offset.x;
-            i32 const dsty = j + offset.y;
-            i32 const dst_index = dsty * dstw + dstx;
+            texels = pixel4::load(src + i);
+        }
+
+        blend4(mode, texels, pixel4::load(dst_row + i)).store(dst_row + i);
+    }
+
+    for (; i < span; ++i)
+    {
+        dst_row[i] = blend_pixel(mode, mirrored ? src[-i] : src[i], dst_row[i]);
+    }
+}
+
+/*
+    clipped once up front rather than per pixel. with upscale > 1 each source
+    row is expanded into a scratch scanline in frame_arena and reused for the
+    upscale destination rows it covers, so the blend always reads a plain run
+    of pixels four at a time. a lut is applied during that expansion, which
+    then happens at 1x as well, so grading is paid once per source pixel and
+    row rather than per destination pixel. flips only change which source
+    pixels are read, mirrored sprites need no copy of their own
+
+    row(y, x, pixels, span, mirrored) gets each visible destination row,
+    mirrored as a bool_constant so the row loop can be a template on it
+*/
+template <typename Row>
+static void for_each_sprite_row(i32 dst_w, i32 dst_h, image_view const &src, vec2i offset, i32 upscale, sprite_style const &style, Row &&row)
+{
+    i32 const x0 = math::max(offset.x, 0);
+    i32 const y0 = math::max(offset.y, 0);
+    i32 const x1 = math::min(offset.x + src.w*upscale, dst_w);
+    i32 const y1 = math::min(offset.y + src.h*upscale, dst_h);
+
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return;
+    }
+
+    i32 const span = x1 - x0;
+    i32 const srcx = x0 - offset.x;
 
-            if (dstx < 0 || dstx > dstw - 1 || dsty < 0 || dsty > dsth - 1)
+    arena::scope const scratch(frame_arena);
+    bool const expands = upscale > 1 || style.lut;
+    u32 *const scanline = expands ? frame_arena.alloc<u32>(span) : nullptr;
+
+    if (expands && !scanline)
+    {
+        return;
+    }
+    i32 expanded_row = -1;
+
+    bool const flip_x = style.flags & blit_flip_x;
+
+    for (i32 y = y0; y < y1; ++y)
+    {
+        i32 srcy = (y - offset.y) / upscale;
+
+        if (style.flags & blit_flip_y)
+        {
+            srcy = src.h - 1 - srcy;
+        }
+
+        u32 const *src_row = src.row(srcy);
+
+        if (scanline)
+        {
+            if (srcy != expanded_row)
             {
-                continue;
+                for (i32 i = 0; i < span; ++i)
+                {
+                    i32 const x = (srcx + i) / upscale;
+                    scanline[i] = src_row[flip_x ? src.w - 1 - x : x];
+                }
+
+                if (style.lut)
+                {
+                    for (i32 i = 0; i < span; ++i)
+                    {
+                        scanline[i] = style.lut->apply(scanline[i]);
+                    }
+                }
+
+                expanded_row = srcy;
             }
 
-            u32 const res = blend(src.data[src_index], dst[dst_index]);
-            dst[dst_index] = res;
+            row(y, x0, scanline, span, std::false_type{});
+        }
+        else if (flip_x)
+        {
+            row(y, x0, src_row + src.w - 1 - srcx, span, std::true_type{});
+        }
+        else
+        {
+            row(y, x0, src_row + srcx, span, std::false_type{});
         }
     }
 }
 
-struct image_load
+/*the blend mode is resolved once, every row runs the kernel for it*/
+static void draw_sprite(image_view const &dst, image_view const &src, vec2i offset, i32 upscale, sprite_style const &style = {})
 {
-    i32 id = -1;
-    image image;
-    bool loaded;
-};
+    dispatch(style.blend, [&](auto const &kernel) {
+        for_each_sprite_row(dst.w, dst.h, src, offset, upscale, style, [&](i32 y, i32 x, u32 const *pixels, i32 span, auto mirrored) {
+            blend_row<decltype(mirrored)::value>(kernel, dst.row(y) + x, pixels, span);
+        });
+    });
+}
+
+/*onto the linear16 target, which only does source-over, style.blend is ignored*/
+static void draw_sprite(linear_target const &dst, image_view const &src, vec2i offset, i32 upscale, sprite_style const &style = {})
+{
+    for_each_sprite_row(dst.w, dst.h, src, offset, upscale, style, [&](i32 y, i32 x, u32 const *pixels, i32 span, auto mirrored) {
+        linear::blend_row<decltype(mirrored)::value>(dst.row(y) + x * 4, pixels, span);
+    });
+}
 
-static bool image_loaded(image_load &img)
+/*narrows the steps [lo, hi) to those where start + step*k lies in [0, limit)*/
+static void clip_steps(f32 start, f32 step, f32 limit, f32 &lo, f32 &hi)
 {
-    if (!img.loaded)
+    if (step == 0.f)
     {
-        if (!image_ready(img.id))
+        if (start < 0.f || start >= limit)
         {
-            print("waiting on image!");
-            return false;
+            hi = lo;
         }
-        else
-        {
-            print("image ready!");
-            img.loaded = true;
 
-            img.image = get_image(img.id);
+        return;
+    }
 
-            print(img.image.w);
-            print(img.image.h);
-            return true;
-        }
+    f32 const a = -start / step;
+    f32 const b = (limit - start) / step;
+    lo = math::max(lo, math::min(a, b));
+    hi = math::min(hi, math::max(a, b));
+}
+
+/*
+    draws src transformed by m about its center, with the center landing on
+    pos. the destination box around the transformed corners is inverse
+    mapped one scanline at a time: the source position of the first pixel
+    is computed in float, then stepped in q16.16 across the row, clipped to
+    the steps that stay inside the source so the inner loop never checks.
+    the four texels of a pixel4 are fetched by scalar loads, wasm has no
+    gather, but their indices come out of one i32x4 multiply-add
+*/
+static void draw_sprite_affine(image_view const &dst, image_view const &src, mat2f const &m, vec2f pos, blend_mode const &mode = {})
+{
+    if (math::abs(m.det()) < 1e-6f)
+    {
+        return;
     }
 
-    return true;
+    vec2f const half{ src.w * .5f, src.h * .5f };
+    vec2f const corners[] = {
+        pos + m * vec2f{ -half.x, -half.y },
+        pos + m * vec2f{  half.x, -half.y },
+        pos + m * vec2f{ -half.x,  half.y },
+        pos + m * vec2f{  half.x,  half.y },
+    };
+
+    i32 const x0 = math::max(static_cast<i32>(math::floor(math::min(math::min(corners[0].x, corners[1].x), math::min(corners[2].x, corners[3].x)))), 0);
+    i32 const y0 = math::max(static_cast<i32>(math::floor(math::min(math::min(corners[0].y, corners[1].y), math::min(corners[2].y, corners[3].y)))), 0);
+    i32 const x1 = math::min(static_cast<i32>(math::ceil(math::max(math::max(corners[0].x, corners[1].x), math::max(corners[2].x, corners[3].x)))), dst.w);
+    i32 const y1 = math::min(static_cast<i32>(math::ceil(math::max(math::max(corners[0].y, corners[1].y), math::max(corners[2].y, corners[3].y)))), dst.h);
+
+    if (x0 >= x1 || y0 >= y1)
+    {
+        return;
+    }
+
+    mat2f const inv = m.inverse();
+
+    /*
+        a row that reaches the source starts within a row of steps of it, and
+        is stepped a pixel past either end, so all of that has to fit q16.16.
+        a matrix squashing the sprite so thin that it does not is not drawn
+    */
+    f32 const reach = math::max(math::abs(inv.x.x), math::abs(inv.y.x)) * (x1 - x0 + 2) + math::max(src.w, src.h);
+
+    if (!(reach < 16384.f))
+    {
+        return;
+    }
+
+    fixed const du = fixed::from_float(inv.x.x);
+    fixed const dv = fixed::from_float(inv.y.x);
+    i32 const ulimit = src.w * fixed::one;
+    i32 const vlimit = src.h * fixed::one;
+
+    v128_t const steps = wasm_i32x4_make(0, 1, 2, 3);
+    v128_t const du4 = wasm_i32x4_splat(du.raw * 4);
+    v128_t const dv4 = wasm_i32x4_splat(dv.raw * 4);
+    v128_t const pitch = wasm_i32x4_splat(src.stride);
+
+    dispatch(mode, [&](auto const &kernel) {
+        for (i32 y = y0; y < y1; ++y)
+        {
+            /*sample at pixel centers*/
+            vec2f const start = inv * (vec2f{ x0 + .5f, y + .5f } - pos) + half;
+
+            f32 lo = 0.f;
+            f32 hi = static_cast<f32>(x1 - x0);
+            clip_steps(start.x, inv.x.x, static_cast<f32>(src.w), lo, hi);
+            clip_steps(start.y, inv.y.x, static_cast<f32>(src.h), lo, hi);
+
+            if (lo >= hi)
+            {
+                continue;
+            }
+
+            fixed const u0 = fixed::from_float(start.x);
+            fixed const v0 = fixed::from_float(start.y);
+
+            /*the float bounds can be off by a step either way, settle them on the stepped values*/
+            auto const inside = [&](i32 k) {
+                i32 const u = u0.raw + du.raw * k;
+                i32 const v = v0.raw + dv.raw * k;
+                return u >= 0 && u < ulimit && v >= 0 && v < vlimit;
+            };
+
+            i32 k0 = math::max(static_cast<i32>(math::floor(lo)) - 1, 0);
+            i32 k1 = math::min(static_cast<i32>(math::ceil(hi)) + 1, x1 - x0);
+
+            while (k0 < k1 && !inside(k0))
+            {
+                k0 += 1;
+            }
+
+            while (k1 > k0 && !inside(k1 - 1))
+            {
+                k1 -= 1;
+            }
+
+            u32 *const dst_row = dst.row(y) + x0;
+            v128_t u = wasm_i32x4_add(wasm_i32x4_splat(u0.raw + du.raw * k0), wasm_i32x4_mul(wasm_i32x4_splat(du.raw), steps));
+            v128_t v = wasm_i32x4_add(wasm_i32x4_splat(v0.raw + dv.raw * k0), wasm_i32x4_mul(wasm_i32x4_splat(dv.raw), steps));
+            i32 k = k0;
+
+            for (; k + 4 <= k1; k += 4)
+            {
+                v128_t const index = wasm_i32x4_add(
+                    wasm_i32x4_mul(wasm_i32x4_shr(v, fixed::frac_bits), pitch),
+                    wasm_i32x4_shr(u, fixed::frac_bits));
+
+                pixel4 const texels = { wasm_i32x4_make(
+                    src.data[wasm_i32x4_extract_lane(index, 0)],
+                    src.data[wasm_i32x4_extract_lane(index, 1)],
+                    src.data[wasm_i32x4_extract_lane(index, 2)],
+                    src.data[wasm_i32x4_extract_lane(index, 3)]) };
+
+                blend4(kernel, texels, pixel4::load(dst_row + k)).store(dst_row + k);
+
+                u = wasm_i32x4_add(u, du4);
+                v = wasm_i32x4_add(v, dv4);
+            }
+
+            for (; k < k1; ++k)
+            {
+                i32 const index = ((v0.raw + dv.raw * k) >> fixed::frac_bits) * src.stride + ((u0.raw + du.raw * k) >> fixed::frac_bits);
+                dst_row[k] = blend_pixel(kernel, src.data[index], dst_row[k]);
+            }
+        }
+    });
 }
 
-static image_load music_off_icon;
-static image_load music_on_icon;
-static image_load parallax_industrial[4];
+/*the icons share a group so they end up side by side in the atlas*/
+constexpr u32 icon_group = 1;
+
+/*globals get no constructor or destructor calls, --no-entry runs no static init and there is no atexit*/
+static_assert(std::is_trivially_destructible_v<atlas>);
+constinit static atlas sprites;
 
-static i32 audio_track = -1;
+static atlas_handle music_off_icon;
+static atlas_handle music_on_icon;
+static atlas_handle parallax_industrial[4];
+
+static audio_handle audio_track;
 
 static bool const *keystate_ptr;
+static bool *keystate_old;
 static u32 keystate_len;
 
 static bool const *buttonstate_ptr;
@@ -187,66 +460,649 @@ static void clear_screen(u32 col)
 
 static bool music_playing = false;
 
-[[clang::export_name("on_frame")]] i32 on_frame()
+static bool key_pressed(u32 code)
+{
+    return keystate_ptr[code] && !keystate_old[code];
+}
+
+/*
+    how the parallax layers are blended, l cycles through the modes. the time
+    clearing and drawing the layers takes is averaged per mode, and printed
+    every few seconds while t has timings on, so the modes can be compared
+    on the same scene
+*/
+enum class compositing : u32
+{
+    /*source-over on the srgb bytes, darkens translucent edges*/
+    srgb,
+    /*linear light, converted back to srgb bytes after every blit*/
+    linear_srgb8,
+    /*linear light in linear_frame, converted once per frame*/
+    linear16,
+};
+
+constexpr char const *compositing_names[] = {
+    "compositing srgb, ms:",
+    "compositing linear srgb8, ms:",
+    "compositing linear16, ms:",
+};
+
+constexpr u32 compositing_report_frames = 240;
+
+static compositing composite = compositing::srgb;
+static bool print_timings = false;
+static linear_target linear_frame;
+static f64 composite_ms[length_of(compositing_names)];
+static u32 composite_frames[length_of(compositing_names)];
+
+static void report_compositing(f64 ms)
 {
-    if (!image_loaded(music_off_icon) ||
-        !image_loaded(music_on_icon)
-        )
+    u32 const mode = static_cast<u32>(composite);
+    composite_ms[mode] += ms;
+    composite_frames[mode] += 1;
+
+    if (composite_frames[mode] == compositing_report_frames)
     {
-        return 1;
+        if (print_timings)
+        {
+            print(compositing_names[mode]);
+            print(static_cast<f32>(composite_ms[mode] / composite_frames[mode]));
+        }
+
+        composite_ms[mode] = 0.;
+        composite_frames[mode] = 0;
     }
+}
 
-    for (auto &parallax : parallax_industrial)
+/*
+    the camera moves in fixed ticks rather than per displayed frame, so it
+    scrolls at the same speed at any refresh rate and reaches the same
+    position after the same time on every machine. each layer keeps its own
+    offset, wrapped to the layer's repeat so it never runs out of range.
+    the rates are the ones the per frame scroll had at 60hz, layer i moving
+    i/2 pixels a frame
+*/
+constexpr f64 tick_ms = 1000. / 120.;
+constexpr fixed camera_speed = fixed::ratio(1, 4);
+constexpr fixed parallax_factors[] = {
+    fixed::from_int(0),
+    fixed::from_int(1),
+    fixed::from_int(2),
+    fixed::from_int(3),
+};
+
+static fixed layer_offsets[length_of(parallax_factors)];
+
+constexpr u32 sky_color = rgba(25, 40, 31, 255);
+
+/*
+    the farther a layer the more it fades into the sky. the layers never
+    change, so each grade is baked into the layer's atlas pixels once and
+    the per frame blits do no grading at all
+*/
+constexpr color_lut far_fog = color_lut::fog(sky_color, 96);
+constexpr color_lut near_fog = color_lut::fog(sky_color, 40);
+constexpr color_lut const *layer_grades[] = {
+    nullptr,
+    &far_fog,
+    &near_fog,
+    nullptr,
+};
+
+/*
+    the look of the finished frame: a touch more contrast, shadows pulled
+    toward blue and highlights toward orange
+*/
+static u32 dusk_grade(f32 r, f32 g, f32 b)
+{
+    f32 const luma = .2126f * r + .7152f * g + .0722f * b;
+    f32 const split = .08f * (luma - .5f);
+
+    auto const contrast = [](f32 v) { return math::lerp(v, v * v * (3.f - 2.f * v), .4f); };
+    auto const channel = [](f32 v) { return static_cast<u32>(math::min(math::max(v, 0.f), 1.f) * 255.f + .5f); };
+
+    return rgba(channel(contrast(r) + split), channel(contrast(g)), channel(contrast(b) - split), 255);
+}
+
+static grade_lut dusk;
+static light_buffer lights;
+static post::chain post_chain;
+
+constexpr char const *post_names[] = {
+    "post scanlines, ms:",
+    "post vignette, ms:",
+    "post grade, ms:",
+    "post lighting, ms:",
+    "post fused, ms:",
+};
+
+static_assert(length_of(post_names) == post::effect_count + 1);
+
+static f64 post_ms[length_of(post_names)];
+static u32 post_frames;
+
+/*
+    1 to 4 toggle the effects, 5 switches the light buffer between 1/4 and
+    1/8 resolution, p between the fused pass and timing each effect alone.
+    the times print with the other timings, see print_timings
+*/
+static void update_post()
+{
+    constexpr u32 keys[] = { keycode_1, keycode_2, keycode_3, keycode_4 };
+
+    for (u32 i = 0; i < length_of(keys); ++i)
     {
-        if (!image_loaded(parallax))
+        if (key_pressed(keys[i]))
         {
-            return 1;
+            post_chain.enabled ^= 1u << i;
         }
     }
 
+    if (key_pressed(keycode_5))
+    {
+        light::resize(lights, screen_size.x, screen_size.y, lights.shift == 2 ? 3 : 2);
+    }
+
+    if (key_pressed(keycode_P))
+    {
+        post_chain.profile = !post_chain.profile;
+        post_frames = 0;
+
+        for (f64 &ms : post_ms)
+        {
+            ms = 0.;
+        }
+    }
+}
+
+static void report_post()
+{
+    for (u32 i = 0; i < length_of(post_ms); ++i)
+    {
+        post_ms[i] += post_chain.ms[i];
+    }
+
+    if (++post_frames < compositing_report_frames)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < length_of(post_ms); ++i)
+    {
+        if (print_timings && post_ms[i] > 0.)
+        {
+            print(post_names[i]);
+            print(static_cast<f32>(post_ms[i] / post_frames));
+        }
+
+        post_ms[i] = 0.;
+    }
+
+    post_frames = 0;
+}
+
+/*
+    lamps and the furnace on the foreground layer, in its pixels before
+    upscaling, so they scroll with it. everything outside them is lit by
+    a dim blue ambient, below the neutral 128
+*/
+struct scene_light
+{
+    vec2f at;
+    f32 radius;
+    u32 color;
+    f32 intensity;
+    f32 flicker;
+    /*a lamp, drawn from lamp_blink and lit as brightly as its frame*/
+    bool lamp;
+};
+
+constexpr u32 lit_layer = 3;
+constexpr u32 ambient_light = rgba(92, 100, 118, 255);
+
+constexpr scene_light foreground_lights[] = {
+    { { 20.f, 52.f }, 36.f, rgba(255, 214, 150, 255), 1.1f, .05f, true },
+    { { 168.f, 56.f }, 36.f, rgba(255, 214, 150, 255), 1.1f, .05f, true },
+    { { 228.f, 48.f }, 36.f, rgba(255, 214, 150, 255), 1.1f, .05f, true },
+    { { 128.f, 100.f }, 64.f, rgba(255, 120, 40, 255), 1.6f, .35f, false },
+};
+
+/*
+    the lamps blink from a sprite sheet of four frames, lit through off and
+    back, drawn here so it needs no asset. the animation caches its frames
+    upscaled like the layers, every lamp on every tile draws from that one
+    cache with its own phase
+*/
+constexpr i32 lamp_w = 6;
+constexpr i32 lamp_h = 8;
+constexpr u32 lamp_durations[] = { 1400, 70, 160, 90 };
+constexpr f32 lamp_glow[] = { 1.f, .45f, .1f, .6f };
+
+static_assert(length_of(lamp_glow) == length_of(lamp_durations));
+
+static u32 lamp_sheet[length_of(lamp_durations) * lamp_w * lamp_h];
+static_assert(std::is_trivially_destructible_v<animation>);
+constinit static animation lamp_blink;
+
+static void init_lamp()
+{
+    i32 const sheet_w = lamp_w * length_of(lamp_durations);
+
+    for (u32 frame = 0; frame < length_of(lamp_durations); ++frame)
+    {
+        f32 const glow = lamp_glow[frame];
+
+        for (i32 y = 0; y < lamp_h; ++y)
+        {
+            for (i32 x = 0; x < lamp_w; ++x)
+            {
+                f32 const dx = (x + .5f - lamp_w * .5f) / (lamp_w * .5f);
+                f32 const dy = (y + .5f - lamp_h * .6f) / (lamp_h * .4f);
+                f32 const bulb = 1.f - (dx * dx + dy * dy);
+                u32 col = 0;
+
+                if (y < 2 && x > 0 && x < lamp_w - 1)
+                {
+                    /*the shade*/
+                    col = rgba(38, 42, 46, 255);
+                }
+                else if (bulb > 0.f)
+                {
+                    u32 const r = static_cast<u32>(math::lerp(70.f, 255.f, glow));
+                    u32 const g = static_cast<u32>(math::lerp(58.f, 232.f, glow));
+                    u32 const b = static_cast<u32>(math::lerp(40.f, 170.f, glow));
+                    col = rgba(r, g, b, static_cast<u32>(math::min(bulb * 2.f, 1.f) * 255.f));
+                }
+
+                lamp_sheet[y * sheet_w + frame * lamp_w + x] = col;
+            }
+        }
+    }
+
+    if (!lamp_blink.init({ lamp_sheet, sheet_w, lamp_h, sheet_w }, lamp_w, lamp_h, lamp_durations, length_of(lamp_durations), 3))
+    {
+        print("no memory for the lamp animation");
+    }
+}
+
+/*lamps blink out of step, by light and by tile*/
+static f64 lamp_phase_ms(u32 light, i32 tile)
+{
+    return light * 530. + tile * 170.;
+}
+
+/*lamp_frames holds the frame each light shows, when it is a lamp*/
+static void splat_layer_lights(vec2i pos, u32 const *lamp_frames, i32 upscale, f64 timestamp_ms)
+{
+    f32 const t = static_cast<f32>(timestamp_ms) * .001f;
+
+    for (u32 i = 0; i < length_of(foreground_lights); ++i)
+    {
+        scene_light const &l = foreground_lights[i];
+        f32 const wobble = .5f + .5f * math::sin(t * math::tau * 7.3f + i) * math::sin(t * math::tau * 3.1f + i * 2.f);
+        f32 const glow = l.lamp ? lamp_glow[lamp_frames[i]] : 1.f;
+        vec2f const center{ pos.x + l.at.x * upscale, pos.y + l.at.y * upscale };
+        light::splat(lights, center, l.radius * upscale, l.color, l.intensity * glow * (1.f - l.flicker * wobble));
+    }
+}
+
+/*
+    sparks are points splatted additively, smoke is drawn as soft puffs
+    through draw_sprite, both thrown from the furnace of every foreground
+    tile. their emitters live in a pool, as does the benchmark fountain b
+    turns on and off, which keeps about 100k sparks in the air
+*/
+constexpr vec2f furnace_at = { 128.f, 100.f };
+constexpr u32 bench_particles = 100000;
+constexpr f32 bench_lifetime = 2.f;
+constexpr i32 puff_size = 12;
+constexpr i32 puff_upscale = 2;
+constexpr u32 puff_shades = 4;
+
+static_assert(std::is_trivially_destructible_v<particle_system> && std::is_trivially_destructible_v<pool<emitter>>);
+constinit static particle_system sparks;
+constinit static particle_system smoke;
+constinit static pool<emitter> emitters;
+static emitter *furnace_sparks[3];
+static emitter *furnace_smoke[3];
+static emitter *bench_fountain;
+static rng particle_rng;
+
+static u32 puff_pixels[puff_shades][puff_size * puff_size];
+
+static f64 particle_update_ms;
+static f64 particle_draw_ms;
+static u32 particle_frames;
+
+static void init_particles()
+{
+    sparks.reserve(bench_particles + bench_particles / 4);
+    sparks.gravity = { 0.f, 240.f };
+    sparks.drag = .6f;
+
+    smoke.reserve(2048);
+    smoke.gravity = { 6.f, -18.f };
+    smoke.drag = .3f;
+
+    for (i32 i = 0; i < particle_system::length_of_ramp; ++i)
+    {
+        /*white hot when thrown, through orange to a dim red*/
+        f32 const t = i / static_cast<f32>(particle_system::length_of_ramp - 1);
+        sparks.ramp[i] = rgba(255, static_cast<u32>(60 + 190 * t * t), static_cast<u32>(20 + 200 * t * t * t), static_cast<u32>(80 + 175 * t));
+    }
+
+    for (u32 shade = 0; shade < puff_shades; ++shade)
+    {
+        f32 const opacity = .45f * (shade + 1) / puff_shades;
+
+        for (i32 y = 0; y < puff_size; ++y)
+        {
+            for (i32 x = 0; x < puff_size; ++x)
+            {
+                f32 const dx = (x + .5f) / puff_size * 2.f - 1.f;
+                f32 const dy = (y + .5f) / puff_size * 2.f - 1.f;
+                f32 const t = math::max(1.f - (dx * dx + dy * dy), 0.f);
+                puff_pixels[shade][y * puff_size + x] = rgba(70, 68, 74, static_cast<u32>(t * t * opacity * 255.f));
+            }
+        }
+    }
+
+    for (i32 i = 0; i < 3; ++i)
+    {
+        furnace_sparks[i] = emitters.create(emitter{ &sparks, {}, 90.f, -math::pi * .5f, 1.1f, 160.f, 120.f, .9f, .6f });
+        furnace_smoke[i] = emitters.create(emitter{ &smoke, {}, 14.f, -math::pi * .5f, .6f, 30.f, 20.f, 3.f, 1.5f });
+    }
+}
+
+static void toggle_bench()
+{
+    if (bench_fountain)
+    {
+        emitters.destroy(bench_fountain);
+        bench_fountain = nullptr;
+        return;
+    }
+
+    vec2f const at = { screen_size.x * .5f, screen_size.y * .9f };
+    bench_fountain = emitters.create(emitter{ &sparks, at, bench_particles / bench_lifetime, -math::pi * .5f, 2.4f, 420.f, 300.f, bench_lifetime - .5f, 1.f });
+}
+
+static void update_particles(f32 dt, vec2f shift)
+{
+    f64 const start = time_ms();
+
+    emitters.for_each([&](emitter &e) { emit(e, dt, particle_rng); });
+    sparks.update(dt, shift);
+    smoke.update(dt, shift);
+
+    particle_update_ms += time_ms() - start;
+}
+
+static void draw_particles(image_view const &dst)
+{
+    f64 const start = time_ms();
+
+    smoke.for_each([&](vec2f pos, u32 shade) {
+        u32 const puff = shade * puff_shades / particle_system::length_of_ramp;
+        i32 const half = puff_size * puff_upscale / 2;
+        vec2i const at = { static_cast<i32>(pos.x) - half, static_cast<i32>(pos.y) - half };
+        draw_sprite(dst, image_view{ puff_pixels[puff], puff_size, puff_size, puff_size }, at, puff_upscale);
+    });
+
+    sparks.splat(dst);
+
+    particle_draw_ms += time_ms() - start;
+}
+
+static void report_particles()
+{
+    if (++particle_frames < compositing_report_frames)
+    {
+        return;
+    }
+
+    /*only while the bench fountain runs or timings are on*/
+    if (bench_fountain || print_timings)
+    {
+        print("particles live:");
+        print(sparks.size() + smoke.size());
+        print("particles update, ms:");
+        print(static_cast<f32>(particle_update_ms / particle_frames));
+        print("particles draw, ms:");
+        print(static_cast<f32>(particle_draw_ms / particle_frames));
+    }
+
+    particle_update_ms = 0.;
+    particle_draw_ms = 0.;
+    particle_frames = 0;
+}
+
+static void grade_layers()
+{
+    for (i32 i = 0; i < length_of(layer_grades); ++i)
+    {
+        if (layer_grades[i])
+        {
+            auto const &layer = *sprites.get(parallax_industrial[i]);
+            bake(layer, layer, *layer_grades[i]);
+        }
+    }
+}
+
+static void advance_camera(f64 timestamp_ms)
+{
+    static f64 last_ms = -1.;
+    static f64 pending_ms = 0.;
+
+    /*a tab that was in the background should not fast forward*/
+    if (last_ms >= 0.)
+    {
+        pending_ms += math::min(timestamp_ms - last_ms, 250.);
+    }
+
+    last_ms = timestamp_ms;
+
+    while (pending_ms >= tick_ms)
+    {
+        for (i32 i = 0; i < length_of(layer_offsets); ++i)
+        {
+            layer_offsets[i] += camera_speed * parallax_factors[i];
+        }
+
+        pending_ms -= tick_ms;
+    }
+}
+
+[[clang::export_name("on_frame")]] i32 on_frame(f64 timestamp_ms)
+{
+    frame_arena.reset();
+
+    if (!sprites.build())
+    {
+        static bool reported = false;
+
+        if (sprites.failed() && !reported)
+        {
+            print("out of memory packing the sprite atlas");
+            reported = true;
+        }
+
+        return 1;
+    }
+
+    static bool layers_graded = false;
+
+    if (!layers_graded)
+    {
+        grade_layers();
+        layers_graded = true;
+    }
+
     if (buttonstate_ptr[buttoncode_left] && !buttonstate_old[buttoncode_left])
     {
         music_playing = !music_playing;
 
         if (music_playing)
         {
-            audio_play(audio_track, true);
+            audio_play(resources::host_id(audio_track), true);
         }
         else 
         {
-            audio_pause(audio_track);
+            audio_pause(resources::host_id(audio_track));
         }
     }
 
+    if (key_pressed(keycode_B))
+    {
+        toggle_bench();
+    }
+
+    if (key_pressed(keycode_L))
+    {
+        composite = static_cast<compositing>((static_cast<u32>(composite) + 1) % length_of(compositing_names));
+    }
+
+    if (key_pressed(keycode_T))
+    {
+        print_timings = !print_timings;
+    }
+
+    update_post();
+
+    if (composite == compositing::linear16 && !linear::resize(linear_frame, screen_size.x, screen_size.y))
+    {
+        composite = compositing::linear_srgb8;
+    }
+
     vec2i const mouse = cursor_xy();
 
-    clear_screen(rgba(25, 40, 31, 255));
-    
-    static i32 scroll{};
+    static f64 last_frame_ms = -1.;
+    f32 const dt = last_frame_ms < 0. ? 0.f : static_cast<f32>(math::min(timestamp_ms - last_frame_ms, 50.) * .001);
+    last_frame_ms = timestamp_ms;
+
+    fixed const foreground_before = layer_offsets[lit_layer];
+    advance_camera(timestamp_ms);
+    f32 const foreground_scroll = -(layer_offsets[lit_layer] - foreground_before).to_float() * 3.f;
+
+    f64 const composite_start = time_ms();
+
+    sprite_style const layer_style = {
+        0,
+        { composite == compositing::linear_srgb8 ? blend_kind::linear_over : blend_kind::over },
+    };
+
+    /*layers and whatever is part of them go wherever this frame composites*/
+    auto const draw_in_scene = [&](image_view const &src, vec2i pos, i32 upscale) {
+        if (composite == compositing::linear16)
+        {
+            draw_sprite(linear_frame, src, pos, upscale);
+        }
+        else
+        {
+            draw_sprite(screen, src, pos, upscale, layer_style);
+        }
+    };
+
+    bool const lighting = (post_chain.enabled & post::lighting) && lights.cells;
+
+    if (lighting)
+    {
+        light::clear(lights, ambient_light);
+    }
+
+    if (composite == compositing::linear16)
+    {
+        linear::fill(linear_frame, sky_color);
+    }
+    else
+    {
+        clear_screen(sky_color);
+    }
+
+    static_assert(length_of(parallax_factors) == length_of(parallax_industrial));
+    static_assert(length_of(layer_grades) == length_of(parallax_industrial));
 
     for (i32 i = 0; i < length_of(parallax_industrial); ++i)
     {
-        i32 const amount = ((scroll/2)*i);
-        auto const &parallax = parallax_industrial[i];
+        auto const &parallax = *sprites.get(parallax_industrial[i]);
+        fixed const period = fixed::from_int(screen_size.x + parallax.w*3);
+
+        while (layer_offsets[i] >= period)
+        {
+            layer_offsets[i] -= period;
+        }
+
+        /*the only rounding per layer, the blit itself stays integer*/
+        i32 const amount = layer_offsets[i].round();
 
         for (i32 j = 0; j < 3; ++j)
         {
-            draw_sprite(screen_size.x, screen_size.y, screen_buffer, parallax.image, {screen_size.x - ((amount + parallax.image.w*3*j)%(screen_size.x + parallax.image.w*3)), screen_size.y - parallax.image.h*3}, 3);
+            vec2i const pos = {screen_size.x - ((amount + parallax.w*3*j)%(screen_size.x + parallax.w*3)), screen_size.y - parallax.h*3};
+
+            draw_in_scene(parallax, pos, 3);
+
+            if (i == lit_layer)
+            {
+                /*looked up once, the same frame is drawn and lights the scene*/
+                u32 lamp_frames[length_of(foreground_lights)] = {};
+
+                for (u32 k = 0; k < length_of(foreground_lights); ++k)
+                {
+                    scene_light const &l = foreground_lights[k];
+
+                    if (l.lamp)
+                    {
+                        lamp_frames[k] = lamp_blink.frame_index(timestamp_ms + lamp_phase_ms(k, j));
+                        image_view const &lamp = lamp_blink.frame(lamp_frames[k]);
+                        draw_in_scene(lamp, {pos.x + static_cast<i32>(l.at.x * 3.f) - lamp.w / 2, pos.y + static_cast<i32>(l.at.y * 3.f) - lamp.h / 2}, 1);
+                    }
+                }
+
+                vec2f const furnace = { pos.x + furnace_at.x * 3.f, pos.y + furnace_at.y * 3.f };
+                furnace_sparks[j]->pos = furnace;
+                furnace_smoke[j]->pos = furnace;
+
+                if (lighting)
+                {
+                    splat_layer_lights(pos, lamp_frames, 3, timestamp_ms);
+                }
+            }
         }
     }
 
+    if (composite == compositing::linear16)
+    {
+        linear::resolve(screen, linear_frame);
+    }
+
+    report_compositing(time_ms() - composite_start);
+
+    update_particles(dt, { foreground_scroll, 0.f });
+    draw_particles(screen);
+    report_particles();
+
+    /*the scene only, the icon is drawn over the finished frame*/
+    post::run(screen, post_chain);
+    report_post();
+
+    auto const &music_icon = *sprites.get(music_playing ? music_on_icon : music_off_icon);
+
     if (music_playing)
     {
-        draw_sprite(screen_size.x, screen_size.y, screen_buffer, music_on_icon.image, {screen_size.x - music_on_icon.image.w, 0}, 1);
+        /*sways and pulses while the music plays, rendered straight from the upright icon*/
+        f32 const t = static_cast<f32>(timestamp_ms) * .001f;
+        f32 const pulse = 1.f + .15f * math::sin(t * math::tau * 2.f);
+        mat2f const m = mat2f::rotation(.35f * math::sin(t * math::tau * .5f)) * mat2f::scale(pulse, pulse);
+        vec2f const center{ screen_size.x - music_icon.w * .5f, music_icon.h * .5f };
+        draw_sprite_affine(screen, music_icon, m, center);
     }
     else
     {
-        draw_sprite(screen_size.x, screen_size.y, screen_buffer, music_off_icon.image, {screen_size.x - music_off_icon.image.w, 0}, 1);
+        draw_sprite(screen, music_icon, {screen_size.x - music_icon.w, 0}, 1);
     }
 
-    scroll += 1;
-
     memcpy(buttonstate_old, buttonstate_ptr, buttonstate_len);
+    memcpy(keystate_old, keystate_ptr, keystate_len);
 
     return 0;
 }
@@ -255,15 +1111,15 @@ static bool music_playing = false;
 {
     screen_size = {w, h};
 
-    music_off_icon.id = request_image("./image/outline_volume_off_white_24dp.png");
-    music_on_icon.id = request_image("./image/outline_volume_up_white_24dp.png");
+    music_off_icon = sprites.add(resources::acquire_image("./image/outline_volume_off_white_24dp.png"), icon_group);
+    music_on_icon = sprites.add(resources::acquire_image("./image/outline_volume_up_white_24dp.png"), icon_group);
 
-    parallax_industrial[0].id = request_image("./image/bg.png");
-    parallax_industrial[1].id = request_image("./image/far-buildings.png");
-    parallax_industrial[2].id = request_image("./image/buildings.png");
-    parallax_industrial[3].id = request_image("./image/skill-foreground.png");
+    parallax_industrial[0] = sprites.add(resources::acquire_image("./image/bg.png"));
+    parallax_industrial[1] = sprites.add(resources::acquire_image("./image/far-buildings.png"));
+    parallax_industrial[2] = sprites.add(resources::acquire_image("./image/buildings.png"));
+    parallax_industrial[3] = sprites.add(resources::acquire_image("./image/skill-foreground.png"));
 
-    audio_track = request_audio("./audio/industrial.wav");
+    audio_track = resources::acquire_audio("./audio/industrial.wav");
 
     {
         auto const[ptr, len] = get_keystate_buffer();
@@ -277,15 +1133,39 @@ static bool music_playing = false;
         buttonstate_len = len;
     }
 
+    keystate_old = reinterpret_cast<bool*>(zalloc(keystate_len));
     buttonstate_old = reinterpret_cast<bool*>(zalloc(buttonstate_len));
 
     {
         auto const[ptr, len] = get_screen_buffer();
         screen_buffer = ptr;
         screen_buffer_len = len;
+        screen = { screen_buffer, screen_size.x, screen_size.y, screen_size.x };
     }
 
-    audio_set_volume(audio_track, .125f);
+    audio_set_volume(resources::host_id(audio_track), .125f);
+
+    linear::init();
+
+    dusk.build(dusk_grade);
+    post_chain.lut = &dusk;
+    post_chain.light = &lights;
+    post_chain.enabled = post::vignette | post::grade | post::lighting;
+    post::resize(post_chain, screen_size.x, screen_size.y);
+    light::resize(lights, screen_size.x, screen_size.y, 2);
+
+    init_particles();
+    init_lamp();
 
     return 1;
+}
+
+/*called by the page as it unloads*/
+[[clang::export_name("teardown")]] void teardown()
+{
+    sprites.release();
+    emitters.release();
+    sparks.release();
+    smoke.release();
+    lamp_blink.release();
 }
\ No newline at end of file
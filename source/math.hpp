@@ -31,15 +31,165 @@ namespace math
     template <typename T>
     concept number = std::is_signed<T>::value || std::is_unsigned<T>::value;
 
-    [[clang::import_name("cosf")]] f32 cos(f32 val);
-    [[clang::import_name("sinf")]] f32 sin(f32 val);
+    namespace host
+    {
+        [[clang::import_name("cosf")]] f32 cos(f32 val);
+        [[clang::import_name("sinf")]] f32 sin(f32 val);
+    }
+
     [[clang::import_name("acosf")]] f32 acos(f32 val);
     [[clang::import_name("asinf")]] f32 asin(f32 val);
-    [[clang::import_name("sqrtf")]] f32 sqrt(f32 val);
-    [[clang::import_name("sqrti")]] f32 sqrt(i32 val);
-    [[clang::import_name("floor")]] f32 floor(f32 val);
-    [[clang::import_name("ceil")]] f32 ceil(f32 val);
-    [[clang::import_name("mod")]] f32 mod(f32 val, f32 b);
+
+    /*these lower to single wasm instructions, no trip through the host*/
+    inline f32 sqrt(f32 val) { return __builtin_sqrtf(val); }
+    inline f32 sqrt(i32 val) { return __builtin_sqrtf(static_cast<f32>(val)); }
+    inline f32 floor(f32 val) { return __builtin_floorf(val); }
+    inline f32 ceil(f32 val) { return __builtin_ceilf(val); }
+    inline f32 trunc(f32 val) { return __builtin_truncf(val); }
+
+    /*sign follows val like js %, wasm has no fmod instruction*/
+    inline f32 mod(f32 val, f32 b) { return val - trunc(val / b) * b; }
+
+    inline v128_t sqrt4(v128_t val) { return wasm_f32x4_sqrt(val); }
+    inline v128_t floor4(v128_t val) { return wasm_f32x4_floor(val); }
+    inline v128_t ceil4(v128_t val) { return wasm_f32x4_ceil(val); }
+    inline v128_t trunc4(v128_t val) { return wasm_f32x4_trunc(val); }
+
+    /*
+        cephes sinf/cosf. |x| is reduced by the nearest even multiple j of pi/4
+        using pi/4 split over three floats, then the sine or cosine polynomial
+        is picked by the octant and the sign by the octant and sign of x.
+        max abs error against double precision sin/cos is 8e-8 for
+        |x| < 8192; past that the reduction loses bits, and past 2^31/(4/pi)
+        it is meaningless
+    */
+    namespace trig
+    {
+        constexpr f32 four_over_pi = 1.27323954473516f;
+        constexpr f32 dp1 = 0.78515625f;
+        constexpr f32 dp2 = 2.4187564849853515625e-4f;
+        constexpr f32 dp3 = 3.77489497744594108e-8f;
+
+        constexpr f32 sin_p0 = -1.9515295891e-4f;
+        constexpr f32 sin_p1 = 8.3321608736e-3f;
+        constexpr f32 sin_p2 = -1.6666654611e-1f;
+
+        constexpr f32 cos_p0 = 2.443315711809948e-5f;
+        constexpr f32 cos_p1 = -1.388731625493765e-3f;
+        constexpr f32 cos_p2 = 4.166664568298827e-2f;
+
+        inline f32 reduce(f32 ax, i32 &j)
+        {
+            j = (static_cast<i32>(ax * four_over_pi) + 1) & ~1;
+            f32 const y = static_cast<f32>(j);
+            return ((ax - y * dp1) - y * dp2) - y * dp3;
+        }
+
+        inline f32 sin_poly(f32 x, f32 z)
+        {
+            return ((sin_p0 * z + sin_p1) * z + sin_p2) * z * x + x;
+        }
+
+        inline f32 cos_poly(f32 z)
+        {
+            return ((cos_p0 * z + cos_p1) * z + cos_p2) * z * z - .5f * z + 1.f;
+        }
+
+        inline v128_t reduce4(v128_t ax, v128_t &j)
+        {
+            j = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(ax, wasm_f32x4_splat(four_over_pi)));
+            j = wasm_v128_and(wasm_i32x4_add(j, wasm_i32x4_splat(1)), wasm_i32x4_splat(~1));
+
+            v128_t const y = wasm_f32x4_convert_i32x4(j);
+            v128_t x = wasm_f32x4_sub(ax, wasm_f32x4_mul(y, wasm_f32x4_splat(dp1)));
+            x = wasm_f32x4_sub(x, wasm_f32x4_mul(y, wasm_f32x4_splat(dp2)));
+            return wasm_f32x4_sub(x, wasm_f32x4_mul(y, wasm_f32x4_splat(dp3)));
+        }
+
+        inline v128_t sin_poly4(v128_t x, v128_t z)
+        {
+            v128_t p = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(sin_p0), z), wasm_f32x4_splat(sin_p1));
+            p = wasm_f32x4_add(wasm_f32x4_mul(p, z), wasm_f32x4_splat(sin_p2));
+            return wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_mul(p, z), x), x);
+        }
+
+        inline v128_t cos_poly4(v128_t z)
+        {
+            v128_t p = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(cos_p0), z), wasm_f32x4_splat(cos_p1));
+            p = wasm_f32x4_add(wasm_f32x4_mul(p, z), wasm_f32x4_splat(cos_p2));
+            p = wasm_f32x4_mul(wasm_f32x4_mul(p, z), z);
+            return wasm_f32x4_add(wasm_f32x4_sub(p, wasm_f32x4_mul(wasm_f32x4_splat(.5f), z)), wasm_f32x4_splat(1.f));
+        }
+
+        /*octants with bit 1 of j set use the cosine polynomial*/
+        inline v128_t select_poly4(v128_t x, v128_t j)
+        {
+            v128_t const z = wasm_f32x4_mul(x, x);
+            v128_t const use_cos = wasm_i32x4_ne(wasm_v128_and(j, wasm_i32x4_splat(2)), wasm_i32x4_splat(0));
+            return wasm_v128_bitselect(cos_poly4(z), sin_poly4(x, z), use_cos);
+        }
+    }
+
+#ifdef MATH_HOST_TRIG
+    inline f32 sin(f32 val) { return host::sin(val); }
+    inline f32 cos(f32 val) { return host::cos(val); }
+
+    inline v128_t sin4(v128_t val)
+    {
+        return wasm_f32x4_make(
+            host::sin(wasm_f32x4_extract_lane(val, 0)),
+            host::sin(wasm_f32x4_extract_lane(val, 1)),
+            host::sin(wasm_f32x4_extract_lane(val, 2)),
+            host::sin(wasm_f32x4_extract_lane(val, 3)));
+    }
+
+    inline v128_t cos4(v128_t val)
+    {
+        return wasm_f32x4_make(
+            host::cos(wasm_f32x4_extract_lane(val, 0)),
+            host::cos(wasm_f32x4_extract_lane(val, 1)),
+            host::cos(wasm_f32x4_extract_lane(val, 2)),
+            host::cos(wasm_f32x4_extract_lane(val, 3)));
+    }
+#else
+    inline f32 sin(f32 val)
+    {
+        i32 j;
+        f32 const x = trig::reduce(val < 0 ? -val : val, j);
+        f32 const z = x * x;
+        f32 const res = j & 2 ? trig::cos_poly(z) : trig::sin_poly(x, z);
+        return ((j & 4) != 0) != (val < 0) ? -res : res;
+    }
+
+    inline f32 cos(f32 val)
+    {
+        i32 j;
+        f32 const x = trig::reduce(val < 0 ? -val : val, j);
+        f32 const z = x * x;
+        j -= 2;
+        f32 const res = j & 2 ? trig::cos_poly(z) : trig::sin_poly(x, z);
+        return j & 4 ? res : -res;
+    }
+
+    inline v128_t sin4(v128_t val)
+    {
+        v128_t j;
+        v128_t const x = trig::reduce4(wasm_f32x4_abs(val), j);
+        v128_t const sign = wasm_v128_xor(
+            wasm_v128_and(val, wasm_i32x4_splat(0x80000000)),
+            wasm_i32x4_shl(wasm_v128_and(j, wasm_i32x4_splat(4)), 29));
+        return wasm_v128_xor(trig::select_poly4(x, j), sign);
+    }
+
+    inline v128_t cos4(v128_t val)
+    {
+        v128_t j;
+        v128_t const x = trig::reduce4(wasm_f32x4_abs(val), j);
+        j = wasm_i32x4_sub(j, wasm_i32x4_splat(2));
+        v128_t const sign = wasm_i32x4_shl(wasm_v128_andnot(wasm_i32x4_splat(4), j), 29);
+        return wasm_v128_xor(trig::select_poly4(x, j), sign);
+    }
+#endif
 
     inline number auto min(number auto a, number auto b)
     {
@@ -93,6 +243,76 @@ namespace math
     {
         return a + t * (b - a);
     }
+
+    /*
+        series based log and exp in double, there is no libm to call. they
+        are for filling tables, not per pixel work: relative error is below
+        1e-12 but the argument reduction loops
+    */
+    constexpr f64 ln2 = 0.6931471805599453;
+
+    inline f64 log(f64 val)
+    {
+        i32 e = 0;
+
+        while (val > 1.5)
+        {
+            val *= .5;
+            e += 1;
+        }
+
+        while (val < .75)
+        {
+            val *= 2.;
+            e -= 1;
+        }
+
+        /*log(x) = 2 atanh((x - 1)/(x + 1)), |z| <= 1/5 here*/
+        f64 const z = (val - 1.) / (val + 1.);
+        f64 const z2 = z * z;
+        f64 term = z;
+        f64 sum = 0.;
+
+        for (i32 k = 1; k < 40; k += 2)
+        {
+            sum += term / k;
+            term *= z2;
+        }
+
+        return 2. * sum + e * ln2;
+    }
+
+    inline f64 exp(f64 val)
+    {
+        i32 const k = static_cast<i32>(__builtin_floor(val / ln2 + .5));
+        f64 const r = val - k * ln2;
+        f64 term = 1.;
+        f64 sum = 1.;
+
+        for (i32 n = 1; n < 24; ++n)
+        {
+            term *= r / n;
+            sum += term;
+        }
+
+        for (i32 i = 0; i < k; ++i)
+        {
+            sum *= 2.;
+        }
+
+        for (i32 i = 0; i > k; --i)
+        {
+            sum *= .5;
+        }
+
+        return sum;
+    }
+
+    /*x > 0, zero otherwise*/
+    inline f64 pow(f64 x, f64 y)
+    {
+        return x > 0. ? exp(y * log(x)) : 0.;
+    }
 }
 
 f32 vec2f::len() const{ return math::sqrt(math::abs(x * x + y * y)); }
@@ -116,9 +336,79 @@ inline vec2i operator&(vec2i v,   i32 s) { return { v.x & s, v.y & s }; }
 
 inline i32 distance(vec2i a, vec2i b) { return (b - a).len(); }
 
+/*
+    q16.16 fixed point. add and subtract are plain integer ops and multiply
+    and divide go through i64, so results are bit identical on every host,
+    unlike float math whose rounding depends on how the expression was
+    compiled. range is [-32768, 32768) with a step of 1/65536
+*/
+struct fixed
+{
+    static constexpr i32 frac_bits = 16;
+    static constexpr i32 one = 1 << frac_bits;
+
+    i32 raw;
+
+    static constexpr fixed from_raw(i32 raw) { return { raw }; }
+    static constexpr fixed from_int(i32 val) { return { val * one }; }
+    static constexpr fixed from_float(f32 val) { return { static_cast<i32>(val * one + (val < 0 ? -.5f : .5f)) }; }
+    static constexpr fixed ratio(i32 num, i32 den) { return { static_cast<i32>(static_cast<i64>(num) * one / den) }; }
+
+    /*floor, so negative values keep stepping evenly through zero*/
+    constexpr i32 to_int() const { return raw >> frac_bits; }
+    constexpr i32 round() const { return (raw + one / 2) >> frac_bits; }
+    constexpr f32 to_float() const { return static_cast<f32>(raw) / one; }
+    constexpr fixed frac() const { return { raw & (one - 1) }; }
+
+    constexpr fixed &operator+=(fixed b) { raw += b.raw; return *this; }
+    constexpr fixed &operator-=(fixed b) { raw -= b.raw; return *this; }
+    constexpr fixed &operator*=(fixed b) { raw = static_cast<i32>(static_cast<i64>(raw) * b.raw >> frac_bits); return *this; }
+    constexpr fixed &operator/=(fixed b) { raw = static_cast<i32>((static_cast<i64>(raw) << frac_bits) / b.raw); return *this; }
+};
+
+constexpr fixed operator+(fixed a, fixed b) { return a += b; }
+constexpr fixed operator-(fixed a, fixed b) { return a -= b; }
+constexpr fixed operator*(fixed a, fixed b) { return a *= b; }
+constexpr fixed operator/(fixed a, fixed b) { return a /= b; }
+constexpr fixed operator*(fixed a,   i32 s) { return { a.raw * s }; }
+constexpr fixed operator/(fixed a,   i32 s) { return { a.raw / s }; }
+constexpr fixed operator-(fixed a) { return { -a.raw }; }
+
+constexpr bool operator==(fixed a, fixed b) { return a.raw == b.raw; }
+constexpr bool operator!=(fixed a, fixed b) { return a.raw != b.raw; }
+constexpr bool operator< (fixed a, fixed b) { return a.raw <  b.raw; }
+constexpr bool operator<=(fixed a, fixed b) { return a.raw <= b.raw; }
+constexpr bool operator> (fixed a, fixed b) { return a.raw >  b.raw; }
+constexpr bool operator>=(fixed a, fixed b) { return a.raw >= b.raw; }
+
+static_assert((fixed::ratio(3, 2) * fixed::from_int(-3)).raw == fixed::from_float(-4.5f).raw);
+static_assert(fixed::from_float(-.25f).to_int() == -1 && fixed::from_float(2.5f).round() == 3);
+
+/*rows x and y, so m * v is (dot(x, v), dot(y, v))*/
 struct mat2f
 { 
     vec2f x, y; 
+
+    static inline mat2f identity() { return { { 1.f, 0.f }, { 0.f, 1.f } }; }
+    static inline mat2f scale(f32 sx, f32 sy) { return { { sx, 0.f }, { 0.f, sy } }; }
+
+    /*counterclockwise on screen is clockwise here, y points down*/
+    static inline mat2f rotation(f32 angle)
+    {
+        f32 const c = math::cos(angle);
+        f32 const s = math::sin(angle);
+        return { { c, -s }, { s, c } };
+    }
+
+    inline f32 det() const { return x.x * y.y - x.y * y.x; }
+
+    /*caller checks det() for singular matrices*/
+    inline mat2f inverse() const
+    {
+        f32 const inv = 1.f / det();
+        return { { y.y * inv, -x.y * inv }, { -y.x * inv, x.x * inv } };
+    }
+
     inline vec2f &operator[](i32 i)
     {
         switch (i) {
@@ -141,7 +431,15 @@ struct mat2f
     {
         return vec2f{
             v.x*x.x+v.y*x.y,
-            v.x*x.y+v.y*x.x,
+            v.x*y.x+v.y*y.y,
+        };
+    }
+
+    inline mat2f operator*(mat2f const &b) const
+    {
+        return mat2f{
+            { x.x*b.x.x+x.y*b.y.x, x.x*b.x.y+x.y*b.y.y },
+            { y.x*b.x.x+y.y*b.y.x, y.x*b.x.y+y.y*b.y.y },
         };
     }
 };
@@ -154,4 +452,124 @@ inline vec2f operator /(vec2f a, vec2f b)
     };
 }
 
+/*
+    simd value types. every operator is a single wasm simd instruction, so
+    code written against these stays vectorized without spelling out the
+    intrinsics
+*/
+struct vec4f
+{
+    v128_t v;
+
+    static inline vec4f splat(f32 s) { return { wasm_f32x4_splat(s) }; }
+    static inline vec4f make(f32 x, f32 y, f32 z, f32 w) { return { wasm_f32x4_make(x, y, z, w) }; }
+    static inline vec4f load(f32 const *src) { return { wasm_v128_load(src) }; }
+    inline void store(f32 *dst) const { wasm_v128_store(dst, v); }
+
+    template <i32 lane>
+    inline f32 get() const { return wasm_f32x4_extract_lane(v, lane); }
+};
+
+inline vec4f operator+(vec4f a, vec4f b) { return { wasm_f32x4_add(a.v, b.v) }; }
+inline vec4f operator-(vec4f a, vec4f b) { return { wasm_f32x4_sub(a.v, b.v) }; }
+inline vec4f operator*(vec4f a, vec4f b) { return { wasm_f32x4_mul(a.v, b.v) }; }
+inline vec4f operator/(vec4f a, vec4f b) { return { wasm_f32x4_div(a.v, b.v) }; }
+inline vec4f operator*(vec4f v,    f32 s) { return { wasm_f32x4_mul(v.v, wasm_f32x4_splat(s)) }; }
+inline vec4f operator/(vec4f v,    f32 s) { return { wasm_f32x4_div(v.v, wasm_f32x4_splat(s)) }; }
+inline vec4f operator-(vec4f v) { return { wasm_f32x4_neg(v.v) }; }
+
+/*rgba with channels in [0, 1], one per f32 lane*/
+struct color4
+{
+    v128_t v;
+
+    static inline color4 make(f32 r, f32 g, f32 b, f32 a) { return { wasm_f32x4_make(r, g, b, a) }; }
+
+    static inline color4 unpack(u32 col)
+    {
+        v128_t const bytes = wasm_v128_load32_zero(&col);
+        v128_t const lanes = wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(bytes));
+        return { wasm_f32x4_mul(wasm_f32x4_convert_i32x4(lanes), wasm_f32x4_splat(1.f / 255.f)) };
+    }
+
+    /*
+        rounds to nearest, the narrows saturate so out of range channels
+        clamp. the first one is signed, the second reads its lanes as i16
+    */
+    inline u32 pack() const
+    {
+        v128_t const lanes = wasm_i32x4_trunc_sat_f32x4(
+            wasm_f32x4_add(wasm_f32x4_mul(v, wasm_f32x4_splat(255.f)), wasm_f32x4_splat(.5f)));
+        v128_t const words = wasm_i16x8_narrow_i32x4(lanes, lanes);
+        return wasm_i32x4_extract_lane(wasm_u8x16_narrow_i16x8(words, words), 0);
+    }
+
+    inline f32 r() const { return wasm_f32x4_extract_lane(v, 0); }
+    inline f32 g() const { return wasm_f32x4_extract_lane(v, 1); }
+    inline f32 b() const { return wasm_f32x4_extract_lane(v, 2); }
+    inline f32 a() const { return wasm_f32x4_extract_lane(v, 3); }
+};
+
+inline color4 operator+(color4 a, color4 b) { return { wasm_f32x4_add(a.v, b.v) }; }
+inline color4 operator-(color4 a, color4 b) { return { wasm_f32x4_sub(a.v, b.v) }; }
+inline color4 operator*(color4 a, color4 b) { return { wasm_f32x4_mul(a.v, b.v) }; }
+inline color4 operator*(color4 c,    f32 s) { return { wasm_f32x4_mul(c.v, wasm_f32x4_splat(s)) }; }
+
+/*four packed rgba8 pixels, r in the low byte of each lane like rgba()*/
+struct pixel4
+{
+    v128_t v;
+
+    static inline pixel4 splat(u32 col) { return { wasm_i32x4_splat(col) }; }
+    static inline pixel4 load(u32 const *src) { return { wasm_v128_load(src) }; }
+    inline void store(u32 *dst) const { wasm_v128_store(dst, v); }
+
+    /*alpha of each pixel in its own u32 lane*/
+    inline v128_t alpha() const { return wasm_u32x4_shr(v, 24); }
+};
+
+/*
+    src over dst by src alpha, bit exact with the scalar blend in main.cpp:
+    transparent pixels keep dst, opaque ones take src and everything in
+    between gets (src*a + dst*(255 - a)) >> 8 with alpha 255. the products
+    fit in u16 lanes, so each half of the pixels takes one multiply-add
+*/
+inline pixel4 blend(pixel4 src, pixel4 dst)
+{
+    v128_t const zero = wasm_i32x4_splat(0);
+    v128_t const full = wasm_u16x8_splat(255);
+
+    v128_t const alpha_lo = wasm_i8x16_shuffle(src.v, zero, 3, 16, 3, 16, 3, 16, 3, 16, 7, 16, 7, 16, 7, 16, 7, 16);
+    v128_t const alpha_hi = wasm_i8x16_shuffle(src.v, zero, 11, 16, 11, 16, 11, 16, 11, 16, 15, 16, 15, 16, 15, 16, 15, 16);
+
+    v128_t const lo = wasm_u16x8_shr(wasm_i16x8_add(
+        wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(src.v), alpha_lo),
+        wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(dst.v), wasm_i16x8_sub(full, alpha_lo))), 8);
+    v128_t const hi = wasm_u16x8_shr(wasm_i16x8_add(
+        wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(src.v), alpha_hi),
+        wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(dst.v), wasm_i16x8_sub(full, alpha_hi))), 8);
+
+    v128_t const mixed = wasm_v128_or(wasm_u8x16_narrow_i16x8(lo, hi), wasm_i32x4_splat(0xff000000));
+
+    v128_t const alpha = src.alpha();
+    v128_t const res = wasm_v128_bitselect(dst.v, mixed, wasm_i32x4_eq(alpha, zero));
+    return { wasm_v128_bitselect(src.v, res, wasm_i32x4_eq(alpha, wasm_i32x4_splat(255))) };
+}
+
+namespace math
+{
+    inline vec4f min(vec4f a, vec4f b) { return { wasm_f32x4_min(a.v, b.v) }; }
+    inline vec4f max(vec4f a, vec4f b) { return { wasm_f32x4_max(a.v, b.v) }; }
+    inline vec4f abs(vec4f v) { return { wasm_f32x4_abs(v.v) }; }
+    inline vec4f sqrt(vec4f v) { return { wasm_f32x4_sqrt(v.v) }; }
+    inline vec4f floor(vec4f v) { return { wasm_f32x4_floor(v.v) }; }
+    inline vec4f sin(vec4f v) { return { sin4(v.v) }; }
+    inline vec4f cos(vec4f v) { return { cos4(v.v) }; }
+
+    inline vec4f lerp(vec4f a, vec4f b, f32 t) { return a + (b - a) * t; }
+    inline color4 lerp(color4 a, color4 b, f32 t) { return a + (b - a) * t; }
+
+    inline color4 clamp(color4 c) { return { wasm_f32x4_min(wasm_f32x4_max(c.v, wasm_f32x4_splat(0.f)), wasm_f32x4_splat(1.f)) }; }
+}
+
 #endif /* MATH */
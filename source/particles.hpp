@@ -0,0 +1,289 @@
+#ifndef PARTICLES
+#define PARTICLES
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "imports.hpp"
+#include "blend.hpp"
+
+/*xorshift32, plenty for scattering particles*/
+struct rng
+{
+    u32 state = 0x9e3779b9;
+
+    u32 next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /*in [0, 1)*/
+    f32 unit()
+    {
+        return (next() >> 8) * (1.f / (1 << 24));
+    }
+
+    f32 range(f32 lo, f32 hi)
+    {
+        return lo + (hi - lo) * unit();
+    }
+};
+
+/*
+    particles of one kind, which share gravity, drag and a colour ramp, kept
+    as a structure of arrays: every field is its own f32 array so update()
+    moves four particles per v128 with no shuffling. the arrays are packed,
+    particles [0, size()) are alive in no particular order
+
+    a particle dies when its life, 1 at birth, reaches 0. the update notes
+    the vectors that had a death in them and afterwards fills each hole with
+    the last particle, going from the back so whatever is moved in is alive
+    and already updated
+*/
+class particle_system
+{
+    f32 *x = nullptr;
+    f32 *y = nullptr;
+    f32 *vx = nullptr;
+    f32 *vy = nullptr;
+    f32 *life = nullptr;
+    f32 *decay = nullptr;
+    u32 *dead_blocks = nullptr;
+
+    u32 count = 0;
+    u32 capacity = 0;
+
+    void move(u32 from, u32 to)
+    {
+        x[to] = x[from];
+        y[to] = y[from];
+        vx[to] = vx[from];
+        vy[to] = vy[from];
+        life[to] = life[from];
+        decay[to] = decay[from];
+    }
+
+public:
+    static constexpr i32 length_of_ramp = 16;
+
+    /*pixels per second squared*/
+    vec2f gravity = { 0.f, 0.f };
+    /*fraction of its velocity a particle keeps over a second, above 0*/
+    f32 drag = 1.f;
+    /*colour from dying, ramp[0], to newborn, ramp[15]; alpha fades the colour in splat()*/
+    u32 ramp[length_of_ramp] = {};
+    /*spawns turned away because the system was full*/
+    u32 dropped = 0;
+
+    /*no destructor so a system at namespace scope needs no atexit registration, see release()*/
+    constexpr particle_system() = default;
+    particle_system(particle_system const &) = delete;
+    particle_system &operator=(particle_system const &) = delete;
+
+    /*frees the particles, reserve() makes room again*/
+    void release()
+    {
+        free(x);
+        x = nullptr;
+        count = 0;
+        capacity = 0;
+    }
+
+    /*room for n particles, everything alive is dropped; false if there was no memory*/
+    bool reserve(u32 n)
+    {
+        release();
+
+        u32 const rounded = (n + 3) & ~3u;
+        size_t const bytes = rounded * 6 * sizeof(f32) + rounded / 4 * sizeof(u32);
+        char *const mem = reinterpret_cast<char*>(aligned_alloc(16, (bytes + 15) & ~size_t(15)));
+
+        if (!mem)
+        {
+            return false;
+        }
+
+        memset(mem, 0, bytes);
+
+        f32 *const fields = reinterpret_cast<f32*>(mem);
+        x = fields;
+        y = fields + rounded;
+        vx = fields + rounded * 2;
+        vy = fields + rounded * 3;
+        life = fields + rounded * 4;
+        decay = fields + rounded * 5;
+        dead_blocks = reinterpret_cast<u32*>(fields + rounded * 6);
+        capacity = rounded;
+
+        return true;
+    }
+
+    bool spawn(vec2f pos, vec2f vel, f32 lifetime)
+    {
+        if (count == capacity)
+        {
+            dropped += 1;
+            return false;
+        }
+
+        x[count] = pos.x;
+        y[count] = pos.y;
+        vx[count] = vel.x;
+        vy[count] = vel.y;
+        life[count] = 1.f;
+        decay[count] = 1.f / lifetime;
+        count += 1;
+
+        return true;
+    }
+
+    /*dt seconds on, every particle also moved by shift, the scroll of whatever it belongs to*/
+    void update(f32 dt, vec2f shift)
+    {
+        f32 const keep = static_cast<f32>(math::exp(dt * math::log(drag)));
+
+        v128_t const dt4 = wasm_f32x4_splat(dt);
+        v128_t const keep4 = wasm_f32x4_splat(keep);
+        v128_t const gx = wasm_f32x4_splat(gravity.x * dt);
+        v128_t const gy = wasm_f32x4_splat(gravity.y * dt);
+        v128_t const sx = wasm_f32x4_splat(shift.x);
+        v128_t const sy = wasm_f32x4_splat(shift.y);
+        v128_t const zero = wasm_f32x4_splat(0.f);
+        u32 dead_count = 0;
+
+        for (u32 i = 0; i < count; i += 4)
+        {
+            v128_t const vx4 = wasm_v128_load(vx + i);
+            v128_t const vy4 = wasm_v128_load(vy + i);
+
+            wasm_v128_store(x + i, wasm_f32x4_add(wasm_f32x4_add(wasm_v128_load(x + i), wasm_f32x4_mul(vx4, dt4)), sx));
+            wasm_v128_store(y + i, wasm_f32x4_add(wasm_f32x4_add(wasm_v128_load(y + i), wasm_f32x4_mul(vy4, dt4)), sy));
+            wasm_v128_store(vx + i, wasm_f32x4_add(wasm_f32x4_mul(vx4, keep4), gx));
+            wasm_v128_store(vy + i, wasm_f32x4_add(wasm_f32x4_mul(vy4, keep4), gy));
+
+            v128_t const life4 = wasm_f32x4_sub(wasm_v128_load(life + i), wasm_f32x4_mul(wasm_v128_load(decay + i), dt4));
+            wasm_v128_store(life + i, life4);
+
+            if (wasm_v128_any_true(wasm_f32x4_le(life4, zero)))
+            {
+                dead_blocks[dead_count++] = i;
+            }
+        }
+
+        while (dead_count--)
+        {
+            u32 const base = dead_blocks[dead_count];
+
+            for (u32 k = math::min(base + 4, count); k-- > base;)
+            {
+                if (life[k] <= 0.f)
+                {
+                    count -= 1;
+                    move(count, k);
+                }
+            }
+        }
+    }
+
+    /*one pixel per particle added onto dst, four positions turned into indices at a time*/
+    void splat(image_view const &dst) const
+    {
+        v128_t const w = wasm_i32x4_splat(dst.w);
+        v128_t const h = wasm_i32x4_splat(dst.h);
+        v128_t const stride = wasm_i32x4_splat(dst.stride);
+        v128_t const zero = wasm_i32x4_splat(0);
+        v128_t const last_shade = wasm_i32x4_splat(length_of_ramp - 1);
+        v128_t const shades = wasm_f32x4_splat(static_cast<f32>(length_of_ramp));
+
+        for (u32 i = 0; i < count; i += 4)
+        {
+            v128_t const px = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_floor(wasm_v128_load(x + i)));
+            v128_t const py = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_floor(wasm_v128_load(y + i)));
+            v128_t const inside = wasm_v128_and(
+                wasm_v128_and(wasm_i32x4_ge(px, zero), wasm_i32x4_lt(px, w)),
+                wasm_v128_and(wasm_i32x4_ge(py, zero), wasm_i32x4_lt(py, h)));
+
+            v128_t const index = wasm_i32x4_add(wasm_i32x4_mul(py, stride), px);
+            v128_t const shade = wasm_i32x4_min(wasm_i32x4_max(
+                wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_mul(wasm_v128_load(life + i), shades)), zero), last_shade);
+
+            u32 lanes = wasm_i32x4_bitmask(inside);
+
+            if (count - i < 4)
+            {
+                lanes &= (1u << (count - i)) - 1;
+            }
+
+            i32 indices[4];
+            i32 colors[4];
+            wasm_v128_store(indices, index);
+            wasm_v128_store(colors, shade);
+
+            for (; lanes; lanes &= lanes - 1)
+            {
+                u32 const lane = __builtin_ctz(lanes);
+                u32 &pixel = dst.data[indices[lane]];
+                pixel = blend_pixel(blend_add{}, ramp[colors[lane]], pixel);
+            }
+        }
+    }
+
+    /*f(vec2f pos, u32 shade) per particle, shade indexes ramp, for drawing with sprites instead*/
+    template <typename F>
+    void for_each(F &&f) const
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            i32 const shade = static_cast<i32>(life[i] * length_of_ramp);
+            f({ x[i], y[i] }, static_cast<u32>(math::min(math::max(shade, 0), length_of_ramp - 1)));
+        }
+    }
+
+    u32 size() const
+    {
+        return count;
+    }
+};
+
+/*
+    spawns particles into a system at rate per second, in a cone of spread
+    radians around angle, 0 pointing right and positive angles down. lives
+    in a pool, see main.cpp, the scene's emitters come and go with it
+*/
+struct emitter
+{
+    particle_system *system;
+    vec2f pos;
+    f32 rate;
+    f32 angle;
+    f32 spread;
+    f32 speed;
+    f32 speed_jitter;
+    f32 lifetime;
+    f32 lifetime_jitter;
+    /*part of a particle owed from the last call*/
+    f32 pending = 0.f;
+};
+
+static void emit(emitter &e, f32 dt, rng &r)
+{
+    e.pending += e.rate * dt;
+
+    while (e.pending >= 1.f)
+    {
+        e.pending -= 1.f;
+
+        f32 const angle = e.angle + e.spread * (r.unit() - .5f);
+        f32 const speed = e.speed + e.speed_jitter * (r.unit() - .5f);
+        vec2f const vel = { math::cos(angle) * speed, math::sin(angle) * speed };
+
+        if (!e.system->spawn(e.pos, vel, e.lifetime + e.lifetime_jitter * r.unit()))
+        {
+            e.pending = 0.f;
+            break;
+        }
+    }
+}
+
+#endif /* PARTICLES */
@@ -0,0 +1,263 @@
+#ifndef POOL
+#define POOL
+#include "wasmdefs.hpp"
+#include "type_traits.hpp"
+
+inline void *operator new(size_t, void *ptr) noexcept
+{
+    return ptr;
+}
+
+/*
+    fixed-size slots for objects that come and go in bulk. slots live in blocks
+    of BlockSize, each block a single walloc allocation spanning whole chunks
+    rather than BlockSize objects scattered over the granule classes
+
+    destroyed slots go on an intrusive freelist, fresh slots are bumped out of
+    the blocks in order. every block keeps a bitmask of its live slots for
+    dense iteration; the mask is only valid while the block's epoch matches
+    the pool's, so clear() bumps the epoch and rewinds the cursor instead of
+    touching the blocks, which stay allocated for the next round
+*/
+template <typename T, u32 BlockSize = 64>
+class pool
+{
+    static_assert(BlockSize && BlockSize % 64 == 0, "pool blocks hold a multiple of 64 slots");
+
+    static constexpr u32 mask_words = BlockSize / 64;
+
+    union slot
+    {
+        slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct block
+    {
+        u32 epoch;
+        u64 live[mask_words];
+        slot slots[BlockSize];
+    };
+
+    /*blocks in allocation order, which is the bump order, and their indices sorted by address for destroy()*/
+    block **blocks = nullptr;
+    u32 *by_address = nullptr;
+    u32 block_count = 0;
+    u32 block_capacity = 0;
+
+    u32 cursor_block = 0;
+    u32 cursor_slot = 0;
+    u32 epoch = 1;
+    u32 live_count = 0;
+    slot *free_head = nullptr;
+
+    bool add_block()
+    {
+        if (block_count == block_capacity)
+        {
+            u32 const capacity = block_capacity ? block_capacity * 2 : 8;
+            block **const new_blocks = reinterpret_cast<block**>(realloc(blocks, capacity * sizeof(block*)));
+            u32 *const new_by_address = reinterpret_cast<u32*>(realloc(by_address, capacity * sizeof(u32)));
+
+            if (new_blocks)
+            {
+                blocks = new_blocks;
+            }
+
+            if (new_by_address)
+            {
+                by_address = new_by_address;
+            }
+
+            if (!new_blocks || !new_by_address)
+            {
+                return false;
+            }
+
+            block_capacity = capacity;
+        }
+
+        block *const b = reinterpret_cast<block*>(aligned_alloc(alignof(block), sizeof(block)));
+
+        if (!b)
+        {
+            return false;
+        }
+
+        b->epoch = 0;
+
+        u32 pos = block_count;
+
+        while (pos && blocks[by_address[pos - 1]] > b)
+        {
+            by_address[pos] = by_address[pos - 1];
+            pos -= 1;
+        }
+
+        by_address[pos] = block_count;
+        blocks[block_count++] = b;
+
+        return true;
+    }
+
+    block *find_block(slot const *s) const
+    {
+        u32 lo = 0;
+        u32 hi = block_count;
+
+        while (hi - lo > 1)
+        {
+            u32 const mid = (lo + hi) / 2;
+
+            if (reinterpret_cast<char const*>(blocks[by_address[mid]]) <= reinterpret_cast<char const*>(s))
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        return blocks[by_address[lo]];
+    }
+
+    slot *bump()
+    {
+        if (cursor_block < block_count && cursor_slot == BlockSize)
+        {
+            cursor_block += 1;
+            cursor_slot = 0;
+        }
+
+        if (cursor_block == block_count && !add_block())
+        {
+            return nullptr;
+        }
+
+        block *const b = blocks[cursor_block];
+
+        if (cursor_slot == 0)
+        {
+            b->epoch = epoch;
+            memset(b->live, 0, sizeof(b->live));
+        }
+
+        return &b->slots[cursor_slot++];
+    }
+
+public:
+    /*
+        no destructor, so a pool at namespace scope is constant initialized
+        and needs no atexit registration. release() gives the memory back
+    */
+    constexpr pool() = default;
+    pool(pool const &) = delete;
+    pool &operator=(pool const &) = delete;
+
+    /*destroys every live object and frees the blocks, the pool can be used again afterwards*/
+    void release()
+    {
+        clear();
+
+        for (u32 i = 0; i < block_count; ++i)
+        {
+            free(blocks[i]);
+        }
+
+        free(blocks);
+        free(by_address);
+        blocks = nullptr;
+        by_address = nullptr;
+        block_count = 0;
+        block_capacity = 0;
+    }
+
+    /*null if walloc is out of memory*/
+    template <typename... Args>
+    T *create(Args &&...args)
+    {
+        slot *s = free_head;
+        block *b;
+
+        if (s)
+        {
+            free_head = s->next;
+            b = find_block(s);
+        }
+        else
+        {
+            if (!(s = bump()))
+            {
+                return nullptr;
+            }
+
+            b = blocks[cursor_block];
+        }
+
+        u32 const index = s - b->slots;
+        b->live[index / 64] |= 1ull << (index % 64);
+        live_count += 1;
+
+        return new (s->storage) T(static_cast<Args&&>(args)...);
+    }
+
+    void destroy(T *obj)
+    {
+        obj->~T();
+
+        slot *const s = reinterpret_cast<slot*>(obj);
+        block *const b = find_block(s);
+        u32 const index = s - b->slots;
+        b->live[index / 64] &= ~(1ull << (index % 64));
+        live_count -= 1;
+
+        s->next = free_head;
+        free_head = s;
+    }
+
+    /*visits live objects in slot order, f may destroy the object it is given*/
+    template <typename F>
+    void for_each(F &&f)
+    {
+        for (u32 i = 0; i < block_count && i <= cursor_block; ++i)
+        {
+            block *const b = blocks[i];
+
+            if (b->epoch != epoch)
+            {
+                continue;
+            }
+
+            for (u32 w = 0; w < mask_words; ++w)
+            {
+                for (u64 mask = b->live[w]; mask; mask &= mask - 1)
+                {
+                    f(*reinterpret_cast<T*>(b->slots[w * 64 + __builtin_ctzll(mask)].storage));
+                }
+            }
+        }
+    }
+
+    /*constant time for trivially destructible T, otherwise every live object is destroyed first*/
+    void clear()
+    {
+        if constexpr (!std::is_trivially_destructible<T>::value)
+        {
+            for_each([](T &obj) { obj.~T(); });
+        }
+
+        epoch += 1;
+        cursor_block = 0;
+        cursor_slot = 0;
+        live_count = 0;
+        free_head = nullptr;
+    }
+
+    u32 size() const
+    {
+        return live_count;
+    }
+};
+
+#endif /* POOL */
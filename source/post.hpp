@@ -0,0 +1,406 @@
+#ifndef POST
+#define POST
+#include "wasmdefs.hpp"
+#include "math.hpp"
+#include "imports.hpp"
+#include "light.hpp"
+
+/*
+    a 3d colour grade, 17 cells a side so the last one lands exactly on 255.
+    a pixel is looked up by trilinear interpolation between the eight cells
+    around it, two pixels per i16x8 vector with q15 weights. the weights per
+    channel value come from a 256 entry table, so no division per pixel
+*/
+struct grade_lut
+{
+    static constexpr i32 size = 17;
+
+    u32 cells[size * size * size];
+    u8 axis_index[256];
+    i16 axis_weight[256];
+
+    /*f(r, g, b) with channels in [0, 1] gives the packed colour for that cell*/
+    template <typename F>
+    void build(F &&f)
+    {
+        for (i32 b = 0; b < size; ++b)
+        {
+            for (i32 g = 0; g < size; ++g)
+            {
+                for (i32 r = 0; r < size; ++r)
+                {
+                    f32 const scale = 1.f / (size - 1);
+                    cells[(b * size + g) * size + r] = f(r * scale, g * scale, b * scale) | 0xff000000;
+                }
+            }
+        }
+
+        for (u32 i = 0; i < 256; ++i)
+        {
+            /*position on the grid in 8.8, 255 maps to exactly size - 1*/
+            u32 const pos = (i * ((size - 1) * 256 * 256 / 255) + 128) >> 8;
+            u32 index = pos >> 8;
+            u32 frac = pos & 255;
+
+            if (index == size - 1)
+            {
+                index -= 1;
+                frac = 256;
+            }
+
+            axis_index[i] = static_cast<u8>(index);
+            axis_weight[i] = static_cast<i16>(frac * 128 - (frac >> 8));
+        }
+    }
+
+    u32 sample(u32 col) const
+    {
+        u32 const base = axis_index[col & 255] + (axis_index[(col >> 8) & 255] + axis_index[(col >> 16) & 255] * size) * size;
+        i32 const wr = axis_weight[col & 255];
+        i32 const wg = axis_weight[(col >> 8) & 255];
+        i32 const wb = axis_weight[(col >> 16) & 255];
+        u32 res = 0xff000000;
+
+        auto const lerp = [](i32 a, i32 b, i32 t) { return a + (((b - a) * t + (1 << 14)) >> 15); };
+
+        for (u32 shift = 0; shift < 24; shift += 8)
+        {
+            auto const cell = [&](u32 offset) { return static_cast<i32>((cells[base + offset] >> shift) & 255); };
+
+            i32 const c00 = lerp(cell(0), cell(1), wr);
+            i32 const c10 = lerp(cell(size), cell(size + 1), wr);
+            i32 const c01 = lerp(cell(size * size), cell(size * size + 1), wr);
+            i32 const c11 = lerp(cell(size * size + size), cell(size * size + size + 1), wr);
+            res |= static_cast<u32>(lerp(lerp(c00, c10, wg), lerp(c01, c11, wg), wb)) << shift;
+        }
+
+        return res;
+    }
+
+    /*the graded channels of two pixels as u16 lanes, alpha lanes 255*/
+    v128_t sample2(u32 p0, u32 p1) const
+    {
+        u32 const base0 = axis_index[p0 & 255] + (axis_index[(p0 >> 8) & 255] + axis_index[(p0 >> 16) & 255] * size) * size;
+        u32 const base1 = axis_index[p1 & 255] + (axis_index[(p1 >> 8) & 255] + axis_index[(p1 >> 16) & 255] * size) * size;
+
+        auto const cell = [&](u32 offset) {
+            return wasm_u16x8_extend_low_u8x16(wasm_i32x4_make(cells[base0 + offset], cells[base1 + offset], 0, 0));
+        };
+
+        auto const weight = [&](u32 shift) {
+            i16 const w0 = axis_weight[(p0 >> shift) & 255];
+            i16 const w1 = axis_weight[(p1 >> shift) & 255];
+            return wasm_i16x8_make(w0, w0, w0, w0, w1, w1, w1, w1);
+        };
+
+        auto const lerp = [](v128_t a, v128_t b, v128_t t) {
+            return wasm_i16x8_add(a, wasm_i16x8_q15mulr_sat(wasm_i16x8_sub(b, a), t));
+        };
+
+        v128_t const wr = weight(0);
+        v128_t const wg = weight(8);
+        v128_t const wb = weight(16);
+
+        v128_t const c00 = lerp(cell(0), cell(1), wr);
+        v128_t const c10 = lerp(cell(size), cell(size + 1), wr);
+        v128_t const c01 = lerp(cell(size * size), cell(size * size + 1), wr);
+        v128_t const c11 = lerp(cell(size * size + size), cell(size * size + size + 1), wr);
+        return lerp(lerp(c00, c10, wg), lerp(c01, c11, wg), wb);
+    }
+};
+
+/*
+    effects over the finished frame. every enabled effect is applied to a
+    pixel between one load and one store: lighting first, the grade, then
+    scanlines and vignette, which are both only a weight per row and per
+    column, so together they cost one multiply per channel. the weights are
+    out of 256 and live in tables built by resize()
+
+    profile runs each effect as a pass of its own and times each one, to
+    see what an effect costs. the picture is the same up to the rounding of
+    applying scanlines and vignette one after the other
+*/
+namespace post
+{
+    constexpr u32 scanlines = 1 << 0;
+    constexpr u32 vignette = 1 << 1;
+    constexpr u32 grade = 1 << 2;
+    constexpr u32 lighting = 1 << 3;
+    constexpr u32 effect_count = 4;
+
+    struct chain
+    {
+        u32 enabled = 0;
+        bool profile = false;
+        grade_lut const *lut = nullptr;
+        light_buffer const *light = nullptr;
+
+        /*every other row is darkened to this, out of 256*/
+        u32 scanline_weight = 192;
+        /*how far the corners fall off, 0 is none*/
+        f32 vignette_strength = .4f;
+
+        u16 *scanline_rows = nullptr;
+        u16 *vignette_rows = nullptr;
+        u16 *vignette_cols = nullptr;
+        u16 *flat = nullptr;
+        i32 w = 0, h = 0;
+
+        /*ms of the last run, per effect when profiling, the fused pass last*/
+        f64 ms[effect_count + 1] = {};
+    };
+
+    /*falls off with the square of the distance from the middle*/
+    static void fill_vignette(u16 *weights, i32 len, f32 strength)
+    {
+        f32 const half = len * .5f;
+
+        for (i32 i = 0; i < len; ++i)
+        {
+            f32 const t = (i + .5f - half) / half;
+            weights[i] = static_cast<u16>((1.f - strength * t * t) * 256.f + .5f);
+        }
+    }
+
+    /*(re)builds the weight tables for a w by h frame, false if there was no memory for them*/
+    static bool resize(chain &c, i32 w, i32 h)
+    {
+        free(c.scanline_rows);
+        free(c.vignette_rows);
+        free(c.vignette_cols);
+        free(c.flat);
+
+        i32 const longest = math::max(w, h);
+        c.scanline_rows = reinterpret_cast<u16*>(malloc(h * sizeof(u16)));
+        c.vignette_rows = reinterpret_cast<u16*>(malloc(h * sizeof(u16)));
+        c.vignette_cols = reinterpret_cast<u16*>(malloc(w * sizeof(u16)));
+        c.flat = reinterpret_cast<u16*>(malloc(longest * sizeof(u16)));
+        c.w = 0;
+        c.h = 0;
+
+        if (!c.scanline_rows || !c.vignette_rows || !c.vignette_cols || !c.flat)
+        {
+            return false;
+        }
+
+        for (i32 y = 0; y < h; ++y)
+        {
+            c.scanline_rows[y] = static_cast<u16>(y & 1 ? c.scanline_weight : 256);
+        }
+
+        for (i32 i = 0; i < longest; ++i)
+        {
+            c.flat[i] = 256;
+        }
+
+        fill_vignette(c.vignette_rows, h, c.vignette_strength);
+        fill_vignette(c.vignette_cols, w, c.vignette_strength);
+        c.w = w;
+        c.h = h;
+
+        return true;
+    }
+
+    template <bool lit, bool graded, bool weighted>
+    static void run_row(u32 *row, i32 w, chain const &c, u16 const *light_row, u16 const *cols, u32 row_weight)
+    {
+        v128_t const rw = wasm_i32x4_splat(row_weight);
+        v128_t const opaque = wasm_i32x4_splat(0xff000000);
+        v128_t const top = wasm_u16x8_splat(255);
+        i32 x = 0;
+
+        for (; x + 4 <= w; x += 4)
+        {
+            v128_t px = wasm_v128_load(row + x);
+            v128_t lo;
+            v128_t hi;
+
+            if constexpr (lit)
+            {
+                /*channel times light out of 128, both at most 255 so the product fits a u16 lane*/
+                lo = wasm_u16x8_shr(wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(px), light::pair(*c.light, light_row, x)), 7);
+                hi = wasm_u16x8_shr(wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(px), light::pair(*c.light, light_row, x + 2)), 7);
+
+                if constexpr (graded)
+                {
+                    px = wasm_u8x16_narrow_i16x8(lo, hi);
+                }
+                else
+                {
+                    lo = wasm_u16x8_min(lo, top);
+                    hi = wasm_u16x8_min(hi, top);
+                }
+            }
+
+            if constexpr (graded)
+            {
+                lo = c.lut->sample2(wasm_i32x4_extract_lane(px, 0), wasm_i32x4_extract_lane(px, 1));
+                hi = c.lut->sample2(wasm_i32x4_extract_lane(px, 2), wasm_i32x4_extract_lane(px, 3));
+            }
+            else if constexpr (!lit)
+            {
+                lo = wasm_u16x8_extend_low_u8x16(px);
+                hi = wasm_u16x8_extend_high_u8x16(px);
+            }
+
+            if constexpr (weighted)
+            {
+                /*at most 256 * 256 >> 8, and 255 * 256 still fits a u16 lane*/
+                v128_t const weight = wasm_u32x4_shr(wasm_i32x4_mul(wasm_u32x4_load16x4(cols + x), rw), 8);
+                v128_t const weight_lo = wasm_i8x16_shuffle(weight, weight, 0, 1, 0, 1, 0, 1, 0, 1, 4, 5, 4, 5, 4, 5, 4, 5);
+                v128_t const weight_hi = wasm_i8x16_shuffle(weight, weight, 8, 9, 8, 9, 8, 9, 8, 9, 12, 13, 12, 13, 12, 13, 12, 13);
+                lo = wasm_u16x8_shr(wasm_i16x8_mul(lo, weight_lo), 8);
+                hi = wasm_u16x8_shr(wasm_i16x8_mul(hi, weight_hi), 8);
+            }
+
+            wasm_v128_store(row + x, wasm_v128_or(wasm_u8x16_narrow_i16x8(lo, hi), opaque));
+        }
+
+        for (; x < w; ++x)
+        {
+            u32 col = row[x];
+
+            if constexpr (lit)
+            {
+                u32 lit_col = 0;
+
+                for (u32 channel = 0; channel < 3; ++channel)
+                {
+                    u32 const l = light::single(*c.light, light_row, x, channel);
+                    lit_col |= math::min(((col >> (channel * 8)) & 255) * l >> 7, 255u) << (channel * 8);
+                }
+
+                col = lit_col;
+            }
+
+            if constexpr (graded)
+            {
+                col = c.lut->sample(col);
+            }
+
+            if constexpr (weighted)
+            {
+                u32 const weight = (cols[x] * row_weight) >> 8;
+                col =
+                    ((((col >>  0) & 255) * weight >> 8) <<  0) |
+                    ((((col >>  8) & 255) * weight >> 8) <<  8) |
+                    ((((col >> 16) & 255) * weight >> 8) << 16);
+            }
+
+            row[x] = col | 0xff000000;
+        }
+    }
+
+    /*rows_a and rows_b are multiplied into one weight per row*/
+    template <bool lit, bool graded, bool weighted>
+    static void pass(image_view const &frame, chain const &c, u16 const *cols, u16 const *rows_a, u16 const *rows_b)
+    {
+        for (i32 y = 0; y < frame.h; ++y)
+        {
+            u16 const *const light_row = lit ? light::row(*c.light, y) : nullptr;
+            run_row<lit, graded, weighted>(frame.row(y), frame.w, c, light_row, cols, (rows_a[y] * rows_b[y]) >> 8);
+        }
+    }
+
+    template <bool lit, bool graded>
+    static void fused(image_view const &frame, chain const &c, u32 enabled)
+    {
+        bool const lines = enabled & scanlines;
+        bool const falloff = enabled & vignette;
+        u16 const *const cols = falloff ? c.vignette_cols : c.flat;
+        u16 const *const rows_a = lines ? c.scanline_rows : c.flat;
+        u16 const *const rows_b = falloff ? c.vignette_rows : c.flat;
+
+        if (lines || falloff)
+        {
+            pass<lit, graded, true>(frame, c, cols, rows_a, rows_b);
+        }
+        else
+        {
+            pass<lit, graded, false>(frame, c, cols, rows_a, rows_b);
+        }
+    }
+
+    /*frame has to be the size given to resize()*/
+    static void run(image_view const &frame, chain &c)
+    {
+        for (f64 &ms : c.ms)
+        {
+            ms = 0.;
+        }
+
+        u32 enabled = c.enabled;
+
+        if (!c.lut)
+        {
+            enabled &= ~grade;
+        }
+
+        if (!c.light || !c.light->cells)
+        {
+            enabled &= ~lighting;
+        }
+
+        if (!enabled || frame.w != c.w || frame.h != c.h)
+        {
+            return;
+        }
+
+        if (!c.profile)
+        {
+            f64 const start = time_ms();
+            bool const lit = enabled & lighting;
+            bool const graded = enabled & grade;
+
+            if (lit && graded)
+            {
+                fused<true, true>(frame, c, enabled);
+            }
+            else if (lit)
+            {
+                fused<true, false>(frame, c, enabled);
+            }
+            else if (graded)
+            {
+                fused<false, true>(frame, c, enabled);
+            }
+            else
+            {
+                fused<false, false>(frame, c, enabled);
+            }
+
+            c.ms[effect_count] = time_ms() - start;
+            return;
+        }
+
+        if (enabled & lighting)
+        {
+            f64 const start = time_ms();
+            pass<true, false, false>(frame, c, c.flat, c.flat, c.flat);
+            c.ms[3] = time_ms() - start;
+        }
+
+        if (enabled & grade)
+        {
+            f64 const start = time_ms();
+            pass<false, true, false>(frame, c, c.flat, c.flat, c.flat);
+            c.ms[2] = time_ms() - start;
+        }
+
+        if (enabled & scanlines)
+        {
+            f64 const start = time_ms();
+            pass<false, false, true>(frame, c, c.flat, c.scanline_rows, c.flat);
+            c.ms[0] = time_ms() - start;
+        }
+
+        if (enabled & vignette)
+        {
+            f64 const start = time_ms();
+            pass<false, false, true>(frame, c, c.vignette_cols, c.vignette_rows, c.flat);
+            c.ms[1] = time_ms() - start;
+        }
+    }
+}
+
+#endif /* POST */
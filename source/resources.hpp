@@ -0,0 +1,284 @@
+#ifndef RESOURCES
+#define RESOURCES
+#include "wasmdefs.hpp"
+#include "imports.hpp"
+
+/*generation 0 never names a live slot, so a default handle is always invalid*/
+template <typename tag>
+struct handle
+{
+    u32 index = 0;
+    u32 generation = 0;
+
+    explicit operator bool() const { return generation != 0; }
+};
+
+struct image_resource
+{
+    image image;
+    bool loaded;
+};
+
+struct audio_resource {};
+
+using image_handle = handle<image_resource>;
+using audio_handle = handle<audio_resource>;
+
+static constexpr u32 fnv1a(char const *str, size_t len)
+{
+    u32 res = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        res ^= static_cast<uint8_t>(str[i]);
+        res *= 16777619u;
+    }
+
+    return res;
+}
+
+/*
+    slots are recycled through an intrusive freelist; every recycle bumps the
+    generation so handles to the previous occupant stop resolving
+*/
+template <typename T>
+struct resource_table
+{
+    static constexpr u32 no_slot = ~0u;
+
+    struct slot
+    {
+        char *uri;
+        u32 uri_len;
+        u32 uri_hash;
+        u32 generation;
+        u32 refs;
+        i32 host_id;
+        u32 next_free;
+        T value;
+    };
+
+    slot *slots = nullptr;
+    u32 count = 0;
+    u32 capacity = 0;
+    u32 free_head = no_slot;
+
+    slot *lookup(handle<T> h)
+    {
+        if (h.index >= count || slots[h.index].generation != h.generation || slots[h.index].refs == 0)
+        {
+            return nullptr;
+        }
+
+        return &slots[h.index];
+    }
+
+    handle<T> find(string_param uri, u32 hash)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            slot const &s = slots[i];
+
+            if (s.refs && s.uri_hash == hash && s.uri_len == uri.size() && 0 == __builtin_memcmp(s.uri, uri.data(), s.uri_len))
+            {
+                return {i, s.generation};
+            }
+        }
+
+        return {};
+    }
+
+    /*an invalid handle if there was no memory, the table is left as it was and the caller still owns host_id*/
+    handle<T> insert(string_param uri, u32 hash, i32 host_id)
+    {
+        char *const uri_copy = reinterpret_cast<char*>(malloc(uri.size()));
+
+        if (!uri_copy)
+        {
+            return {};
+        }
+
+        u32 index = free_head;
+
+        if (index != no_slot)
+        {
+            free_head = slots[index].next_free;
+        }
+        else
+        {
+            if (count == capacity)
+            {
+                u32 const new_capacity = capacity ? capacity * 2 : 16;
+                slot *const new_slots = reinterpret_cast<slot*>(realloc(slots, new_capacity * sizeof(slot)));
+
+                if (!new_slots)
+                {
+                    free(uri_copy);
+                    return {};
+                }
+
+                slots = new_slots;
+                capacity = new_capacity;
+            }
+
+            index = count++;
+            slots[index].generation = 1;
+        }
+
+        slot &s = slots[index];
+        s.uri = uri_copy;
+        memcpy(s.uri, uri.data(), uri.size());
+        s.uri_len = uri.size();
+        s.uri_hash = hash;
+        s.refs = 1;
+        s.host_id = host_id;
+        s.next_free = no_slot;
+        s.value = {};
+
+        return {index, s.generation};
+    }
+
+    /*returns the slot if this dropped the last reference, the caller tears down the host side*/
+    slot *release(handle<T> h)
+    {
+        slot *s = lookup(h);
+
+        if (!s || --s->refs)
+        {
+            return nullptr;
+        }
+
+        free(s->uri);
+        s->uri = nullptr;
+        s->generation = s->generation + 1 ? s->generation + 1 : 1;
+        s->next_free = free_head;
+        free_head = h.index;
+
+        return s;
+    }
+};
+
+namespace resources
+{
+    static resource_table<image_resource> images;
+    static resource_table<audio_resource> audio;
+
+    static image_handle acquire_image(string_param uri)
+    {
+        u32 const hash = fnv1a(uri.data(), uri.size());
+
+        if (image_handle const existing = images.find(uri, hash))
+        {
+            images.lookup(existing)->refs += 1;
+            return existing;
+        }
+
+        i32 const host_id = request_image(uri);
+        image_handle const res = images.insert(uri, hash, host_id);
+
+        if (!res)
+        {
+            release_image(host_id);
+        }
+
+        return res;
+    }
+
+    static audio_handle acquire_audio(string_param uri)
+    {
+        u32 const hash = fnv1a(uri.data(), uri.size());
+
+        if (audio_handle const existing = audio.find(uri, hash))
+        {
+            audio.lookup(existing)->refs += 1;
+            return existing;
+        }
+
+        i32 const host_id = request_audio(uri);
+        audio_handle const res = audio.insert(uri, hash, host_id);
+
+        if (!res)
+        {
+            release_audio(host_id);
+        }
+
+        return res;
+    }
+
+    static void retain(image_handle h)
+    {
+        if (auto *s = images.lookup(h))
+        {
+            s->refs += 1;
+        }
+    }
+
+    static void retain(audio_handle h)
+    {
+        if (auto *s = audio.lookup(h))
+        {
+            s->refs += 1;
+        }
+    }
+
+    /*the host frees the pixel buffer it malloc'd in image_ready*/
+    static void release(image_handle h)
+    {
+        if (auto *s = images.release(h))
+        {
+            release_image(s->host_id);
+            s->value = {};
+        }
+    }
+
+    static void release(audio_handle h)
+    {
+        if (auto *s = audio.release(h))
+        {
+            release_audio(s->host_id);
+        }
+    }
+
+    static bool image_ready(image_handle h)
+    {
+        auto *s = images.lookup(h);
+
+        if (!s)
+        {
+            return false;
+        }
+
+        if (!s->value.loaded)
+        {
+            if (!::image_ready(s->host_id))
+            {
+                print("waiting on image!");
+                return false;
+            }
+
+            print("image ready!");
+            s->value.loaded = true;
+            s->value.image = get_image(s->host_id);
+
+            print(s->value.image.w);
+            print(s->value.image.h);
+        }
+
+        return true;
+    }
+
+    /*null until the image is ready or once the handle has gone stale*/
+    static image const *get(image_handle h)
+    {
+        auto *s = images.lookup(h);
+        return s && s->value.loaded ? &s->value.image : nullptr;
+    }
+
+    static i32 host_id(audio_handle h)
+    {
+        auto *s = audio.lookup(h);
+        return s ? s->host_id : -1;
+    }
+}
+
+#endif /* RESOURCES */
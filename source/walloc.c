@@ -79,6 +79,8 @@ enum chunk_kind {
 #undef DEFINE_SMALL_OBJECT_CHUNK_KIND
 
   SMALL_OBJECT_CHUNK_KINDS,
+  LARGE_OBJECT_TAIL = 252,
+  FREE_LARGE_OBJECT_TAIL = 253,
   FREE_LARGE_OBJECT = 254,
   LARGE_OBJECT = 255
 };
@@ -112,6 +114,11 @@ static unsigned chunk_kind_to_granules(enum chunk_kind kind) {
 // chunk_kinds[chunk_idx] is [FREE_]LARGE_OBJECT, then the pointer is a large
 // object, otherwise the kind indicates the size in granules of the objects in
 // the chunk.
+//
+// The last chunk of a multi-chunk large object that ends within the page of
+// its header is tagged [FREE_]LARGE_OBJECT_TAIL.  Chunks in a page are tiled
+// by objects, so the chunk before any object start is the tail of its
+// predecessor, which is how a free finds a free neighbour on its left.
 struct page_header {
   uint8_t chunk_kinds[CHUNKS_PER_PAGE];
 };
@@ -148,15 +155,63 @@ struct large_object {
 static inline void* get_large_object_payload(struct large_object *obj) {
   return ((char*) obj) + LARGE_OBJECT_HEADER_SIZE;
 }
+// Payloads handed out by aligned_alloc() may start further into the first
+// chunk than the header, so find the header by rounding down to the chunk.
 static inline struct large_object* get_large_object(void *ptr) {
-  return (struct large_object*) (((char*) ptr) - LARGE_OBJECT_HEADER_SIZE);
+  return (struct large_object*) (((uintptr_t) ptr) & ~CHUNK_MASK);
+}
+static inline size_t get_large_object_chunks(struct large_object *obj) {
+  return (obj->size + LARGE_OBJECT_HEADER_SIZE) >> CHUNK_SIZE_LOG_2;
+}
+
+// While a large object is free, the first word of its payload links back to
+// the previous object in its size class, and the last word of its last chunk
+// is a boundary tag pointing at its header.
+static inline struct large_object** get_free_large_object_prev(struct large_object *obj) {
+  return (struct large_object**) get_large_object_payload(obj);
 }
+static inline struct large_object** get_free_large_object_footer(struct large_object *obj) {
+  return ((struct large_object**) (((char*) get_large_object_payload(obj)) + obj->size)) - 1;
+}
+
+// Free large objects are segregated by size in the manner of TLSF.  The
+// first level splits chunk counts by powers of two and the second level
+// splits each power of two linearly into LARGE_OBJECT_SL_COUNT classes.  A
+// bitmap per level records which classes are non-empty, so a fit is found
+// with a couple of count-trailing-zeros rather than a list walk.
+#define LARGE_OBJECT_SL_COUNT_LOG_2 3
+#define LARGE_OBJECT_SL_COUNT (1 << LARGE_OBJECT_SL_COUNT_LOG_2)
+#define LARGE_OBJECT_FL_COUNT \
+  (32 - CHUNK_SIZE_LOG_2 - LARGE_OBJECT_SL_COUNT_LOG_2 + 1)
 
 static struct freelist *small_object_freelists[SMALL_OBJECT_CHUNK_KINDS];
-static struct large_object *large_objects;
+static struct large_object
+  *large_object_freelists[LARGE_OBJECT_FL_COUNT][LARGE_OBJECT_SL_COUNT];
+static unsigned large_object_fl_bitmap;
+static uint8_t large_object_sl_bitmap[LARGE_OBJECT_FL_COUNT];
+
+// One bit per page of the address space, set if a free large object ends
+// exactly at the end of that page.  The page's own chunk kinds can't tell us,
+// as they are payload whenever the page is covered by a multi-page object.
+static unsigned free_large_object_page_ends[(1 << (32 - PAGE_SIZE_LOG_2)) / 32];
+
+static void
+large_object_size_class(size_t chunks, unsigned *fl, unsigned *sl) {
+  if (chunks < LARGE_OBJECT_SL_COUNT) {
+    *fl = 0;
+    *sl = chunks;
+    return;
+  }
+  unsigned log2 = 31 - __builtin_clz(chunks);
+  *fl = log2 - LARGE_OBJECT_SL_COUNT_LOG_2 + 1;
+  *sl = (chunks >> (log2 - LARGE_OBJECT_SL_COUNT_LOG_2)) - LARGE_OBJECT_SL_COUNT;
+}
 
 extern void __heap_base;
+static uintptr_t walloc_heap_start;
 static size_t walloc_heap_size;
+static size_t walloc_grow_count;
+static size_t walloc_grow_bytes;
 
 static struct page*
 allocate_pages(size_t payload_size, size_t *n_allocated) {
@@ -172,6 +227,7 @@ allocate_pages(size_t payload_size, size_t *n_allocated) {
     preallocated = heap_size - heap_base; // Preallocated pages.
     walloc_heap_size = preallocated;
     base -= preallocated;
+    walloc_heap_start = base;
   }
 
   if (preallocated < needed) {
@@ -183,6 +239,8 @@ allocate_pages(size_t payload_size, size_t *n_allocated) {
       return NULL;
     }
     walloc_heap_size += grow;
+    walloc_grow_count++;
+    walloc_grow_bytes += grow;
   }
   
   struct page *ret = (struct page *)base;
@@ -199,100 +257,270 @@ allocate_chunk(struct page *page, unsigned idx, enum chunk_kind kind) {
   return page->chunks[idx].data;
 }
 
-// It's possible for splitting to produce a large object of size 248 (256 minus
-// the header size) -- i.e. spanning a single chunk.  In that case, push the
-// chunk back on the GRANULES_32 small object freelist.
-static void maybe_repurpose_single_chunk_large_objects_head(void) {
-  if (large_objects->size < CHUNK_SIZE) {
-    unsigned idx = get_chunk_index(large_objects);
-    char *ptr = allocate_chunk(get_page(large_objects), idx, GRANULES_32);
-    large_objects = large_objects->next;
-    struct freelist* head = (struct freelist *)ptr;
-    head->next = small_object_freelists[GRANULES_32];
-    small_object_freelists[GRANULES_32] = head;
-  }
-}
-
-// If there have been any large-object frees since the last large object
-// allocation, go through the freelist and merge any adjacent objects.
-static int pending_large_object_compact = 0;
-static struct large_object**
-maybe_merge_free_large_object(struct large_object** prev) {
-  struct large_object *obj = *prev;
-  while (1) {
-    char *end = get_large_object_payload(obj) + obj->size;
-    ASSERT_ALIGNED((uintptr_t)end, CHUNK_SIZE);
-    unsigned chunk = get_chunk_index(end);
-    if (chunk < FIRST_ALLOCATABLE_CHUNK) {
-      // Merging can't create a large object that newly spans the header chunk.
-      // This check also catches the end-of-heap case.
-      return prev;
+static inline char* get_large_object_end(struct large_object *obj) {
+  return ((char*) get_large_object_payload(obj)) + obj->size;
+}
+static inline int large_object_ends_on_page(struct large_object *obj) {
+  return (((uintptr_t) get_large_object_end(obj)) & PAGE_MASK) == 0;
+}
+static void
+mark_free_large_object_page_end(struct large_object *obj, int is_free) {
+  if (large_object_ends_on_page(obj)) {
+    unsigned page = (((uintptr_t) get_large_object_end(obj)) >> PAGE_SIZE_LOG_2) - 1;
+    if (is_free)
+      free_large_object_page_ends[page / 32] |= 1u << (page % 32);
+    else
+      free_large_object_page_ends[page / 32] &= ~(1u << (page % 32));
+  }
+}
+static inline int free_large_object_ends_before(struct page *page) {
+  unsigned idx = (((uintptr_t) page) >> PAGE_SIZE_LOG_2) - 1;
+  return (free_large_object_page_ends[idx / 32] >> (idx % 32)) & 1;
+}
+
+// Tag the last chunk of OBJ, unless OBJ is a single chunk or runs on into
+// later pages; in the latter case the chunk kinds of those pages are payload.
+static void
+tag_large_object_tail(struct large_object *obj, enum chunk_kind kind) {
+  char *last = get_large_object_end(obj) - 1;
+  struct page *page = get_page(obj);
+  if (get_page(last) == page && get_chunk_index(last) != get_chunk_index(obj))
+    page->header.chunk_kinds[get_chunk_index(last)] = kind;
+}
+
+static void
+insert_free_large_object(struct large_object *obj) {
+  unsigned fl, sl;
+  large_object_size_class(get_large_object_chunks(obj), &fl, &sl);
+  struct large_object *head = large_object_freelists[fl][sl];
+  obj->next = head;
+  *get_free_large_object_prev(obj) = NULL;
+  if (head)
+    *get_free_large_object_prev(head) = obj;
+  large_object_freelists[fl][sl] = obj;
+  large_object_fl_bitmap |= 1u << fl;
+  large_object_sl_bitmap[fl] |= 1u << sl;
+
+  allocate_chunk(get_page(obj), get_chunk_index(obj), FREE_LARGE_OBJECT);
+  tag_large_object_tail(obj, FREE_LARGE_OBJECT_TAIL);
+  *get_free_large_object_footer(obj) = obj;
+  mark_free_large_object_page_end(obj, 1);
+}
+
+static void
+remove_free_large_object(struct large_object *obj) {
+  unsigned fl, sl;
+  large_object_size_class(get_large_object_chunks(obj), &fl, &sl);
+  struct large_object *prev = *get_free_large_object_prev(obj);
+  if (prev)
+    prev->next = obj->next;
+  else
+    large_object_freelists[fl][sl] = obj->next;
+  if (obj->next)
+    *get_free_large_object_prev(obj->next) = prev;
+  if (!large_object_freelists[fl][sl]) {
+    large_object_sl_bitmap[fl] &= ~(1u << sl);
+    if (!large_object_sl_bitmap[fl])
+      large_object_fl_bitmap &= ~(1u << fl);
+  }
+  mark_free_large_object_page_end(obj, 0);
+}
+
+// Find a free large object of at least CHUNKS chunks, header included.
+// Rounding the request up to the next size class means that any object in
+// the first non-empty class at or above it fits, so the lookup is two
+// bitmap scans.  Objects in the request's own class that happen to be big
+// enough are passed over; on a miss the caller grows the heap.
+static struct large_object*
+find_free_large_object(size_t chunks) {
+  unsigned fl, sl;
+  size_t rounded = chunks;
+  if (rounded >= LARGE_OBJECT_SL_COUNT) {
+    unsigned log2 = 31 - __builtin_clz(rounded);
+    rounded += (1u << (log2 - LARGE_OBJECT_SL_COUNT_LOG_2)) - 1;
+  }
+  large_object_size_class(rounded, &fl, &sl);
+  if (fl >= LARGE_OBJECT_FL_COUNT)
+    return NULL;
+  unsigned sl_map = large_object_sl_bitmap[fl] & (~0u << sl);
+  if (!sl_map) {
+    unsigned fl_map = large_object_fl_bitmap & (~0u << fl) & ~(1u << fl);
+    if (!fl_map)
+      return NULL;
+    fl = __builtin_ctz(fl_map);
+    sl_map = large_object_sl_bitmap[fl];
+  }
+  return large_object_freelists[fl][__builtin_ctz(sl_map)];
+}
+
+// Release OBJ, merging it with free neighbours.  The right neighbour starts
+// where OBJ ends; the left neighbour is found through the tail tag and
+// boundary tag of the chunk just before OBJ.  Neighbours across a page
+// boundary are merged only if the result ends on a page boundary, as a large
+// object that spans pages consumes the page headers it covers.
+static void
+free_large_object(struct large_object *obj) {
+  char *end = get_large_object_end(obj);
+  ASSERT_ALIGNED((uintptr_t)end, CHUNK_SIZE);
+  unsigned end_chunk = get_chunk_index(end);
+  if (end_chunk >= FIRST_ALLOCATABLE_CHUNK) {
+    if (get_page(end)->header.chunk_kinds[end_chunk] == FREE_LARGE_OBJECT) {
+      struct large_object *next = (struct large_object*) end;
+      remove_free_large_object(next);
+      obj->size += LARGE_OBJECT_HEADER_SIZE + next->size;
     }
-    struct page *page = get_page(end);
-    if (page->header.chunk_kinds[chunk] != FREE_LARGE_OBJECT) {
-      return prev;
+  } else if ((uintptr_t)end < __builtin_wasm_memory_size(0) * PAGE_SIZE) {
+    struct page *page = (struct page*) end;
+    struct large_object *next =
+      (struct large_object*) page->chunks[FIRST_ALLOCATABLE_CHUNK].data;
+    if (page->header.chunk_kinds[FIRST_ALLOCATABLE_CHUNK] == FREE_LARGE_OBJECT
+        && large_object_ends_on_page(next)) {
+      remove_free_large_object(next);
+      obj->size += PAGE_HEADER_SIZE + LARGE_OBJECT_HEADER_SIZE + next->size;
     }
-    struct large_object *next = (struct large_object*) end;
-
-    struct large_object **prev_prev = &large_objects, *walk = large_objects;
-    while (1) {
-      ASSERT(walk);
-      if (walk == next) {
-        obj->size += LARGE_OBJECT_HEADER_SIZE + walk->size;
-        *prev_prev = walk->next;
-        if (prev == &walk->next) {
-          prev = prev_prev;
-        }
+  }
+
+  struct page *page = get_page(obj);
+  unsigned idx = get_chunk_index(obj);
+  if (idx > FIRST_ALLOCATABLE_CHUNK) {
+    struct large_object *prev = NULL;
+    switch (page->header.chunk_kinds[idx - 1]) {
+      case FREE_LARGE_OBJECT:
+        prev = (struct large_object*) page->chunks[idx - 1].data;
+        break;
+      case FREE_LARGE_OBJECT_TAIL:
+        prev = ((struct large_object**) obj)[-1];
+        break;
+      default:
         break;
-      }
-      prev_prev = &walk->next;
-      walk = walk->next;
     }
+    if (prev) {
+      remove_free_large_object(prev);
+      prev->size += LARGE_OBJECT_HEADER_SIZE + obj->size;
+      obj = prev;
+    }
+  }
+  // Merging may have brought OBJ to the start of its page.
+  if (get_chunk_index(obj) == FIRST_ALLOCATABLE_CHUNK
+      && large_object_ends_on_page(obj)
+      && free_large_object_ends_before(page)) {
+    struct large_object *prev = ((struct large_object**) page)[-1];
+    remove_free_large_object(prev);
+    prev->size += PAGE_HEADER_SIZE + LARGE_OBJECT_HEADER_SIZE + obj->size;
+    obj = prev;
   }
+
+  insert_free_large_object(obj);
 }
+
+// Shrink OBJ to the smallest chunk-aligned size that holds SIZE payload bytes
+// and release what's left after it as a free object.
 static void
-maybe_compact_free_large_objects(void) {
-  if (pending_large_object_compact) {
-    pending_large_object_compact = 0;
-    struct large_object **prev = &large_objects;
-    while (*prev) {
-      prev = &(*maybe_merge_free_large_object(prev))->next;
+split_large_object_tail(struct large_object *obj, size_t size) {
+  char *start = get_large_object_payload(obj);
+  char *end = start + obj->size;
+  struct large_object *tail = NULL;
+  size_t tail_size = (obj->size - size) & ~CHUNK_MASK;
+  if (tail_size) {
+    if (get_page(obj) == get_page(end - tail_size - 1)) {
+      // The allocation does not span a page boundary; yay.
+      ASSERT_ALIGNED((uintptr_t)end, CHUNK_SIZE);
+    } else {
+      // A large object that spans more than one page will consume all of its
+      // tail pages.  Therefore if the split traverses a page boundary, round up
+      // to page size.
+      ASSERT_ALIGNED((uintptr_t)end, PAGE_SIZE);
+      size_t first_page_size = PAGE_SIZE - (((uintptr_t)start) & PAGE_MASK);
+      size_t tail_pages_size = align(size - first_page_size, PAGE_SIZE);
+      tail_size = obj->size - first_page_size - tail_pages_size;
     }
+    obj->size -= tail_size;
+    
+    unsigned tail_idx = get_chunk_index(end - tail_size);
+    while (tail_idx < FIRST_ALLOCATABLE_CHUNK && tail_size) {
+      // We would be splitting in a page header; don't do that.
+      tail_size -= CHUNK_SIZE;
+      tail_idx++;
+    }
+    
+    if (tail_size) {
+      struct page *page = get_page(end - tail_size);
+      char *tail_ptr = allocate_chunk(page, tail_idx, FREE_LARGE_OBJECT);
+      tail = (struct large_object *) tail_ptr;
+      tail->size = tail_size - LARGE_OBJECT_HEADER_SIZE;
+      ASSERT_ALIGNED((uintptr_t)(get_large_object_payload(tail) + tail->size), CHUNK_SIZE);
+    }
+  }
+
+  // Tag before releasing the tail, whose left neighbour lookup reads it.
+  tag_large_object_tail(obj, LARGE_OBJECT_TAIL);
+  if (tail)
+    free_large_object(tail);
+
+  ASSERT_ALIGNED((uintptr_t)(get_large_object_payload(obj) + obj->size), CHUNK_SIZE);
+}
+
+// Try to resize OBJ in place so that its payload holds SIZE bytes.  Growing
+// absorbs the following object if it is free and big enough; shrinking
+// splits off the tail.  Returns 0 if OBJ would have to move.
+static int
+resize_large_object(struct large_object *obj, size_t size) {
+  if (size > obj->size) {
+    char *end = get_large_object_end(obj);
+    unsigned end_chunk = get_chunk_index(end);
+    struct large_object *next = NULL;
+    size_t gap = 0;
+    if (end_chunk >= FIRST_ALLOCATABLE_CHUNK) {
+      if (get_page(end)->header.chunk_kinds[end_chunk] == FREE_LARGE_OBJECT)
+        next = (struct large_object*) end;
+    } else if ((uintptr_t)end < __builtin_wasm_memory_size(0) * PAGE_SIZE) {
+      struct page *page = (struct page*) end;
+      struct large_object *first =
+        (struct large_object*) page->chunks[FIRST_ALLOCATABLE_CHUNK].data;
+      if (page->header.chunk_kinds[FIRST_ALLOCATABLE_CHUNK] == FREE_LARGE_OBJECT
+          && large_object_ends_on_page(first)) {
+        next = first;
+        gap = PAGE_HEADER_SIZE;
+      }
+    }
+    if (!next
+        || obj->size + gap + LARGE_OBJECT_HEADER_SIZE + next->size < size)
+      return 0;
+    remove_free_large_object(next);
+    obj->size += gap + LARGE_OBJECT_HEADER_SIZE + next->size;
   }
+
+  split_large_object_tail(obj, size);
+  return 1;
 }
 
 // Allocate a large object with enough space for SIZE payload bytes.  Returns a
 // large object with a header, aligned on a chunk boundary, whose payload size
 // may be larger than SIZE, and whose total size (header included) is
 // chunk-aligned.  Either a suitable allocation is found in the large object
-// freelist, or we ask the OS for some more pages and treat those pages as a
+// freelists, or we ask the OS for some more pages and treat those pages as a
 // large object.  If the allocation fits in that large object and there's more
 // than an aligned chunk's worth of data free at the end, the large object is
 // split.
 //
+// If FRESH is non-null, it is set when the payload comes straight from newly
+// obtained pages and is therefore still zeroed.
+//
 // The return value's corresponding chunk in the page as starting a large
 // object.
 static struct large_object*
-allocate_large_object(size_t size) {
-  maybe_compact_free_large_objects();
-  struct large_object *best = NULL, **best_prev = &large_objects;
-  size_t best_size = -1;
-  for (struct large_object **prev = &large_objects, *walk = large_objects;
-       walk;
-       prev = &walk->next, walk = walk->next) {
-    if (walk->size >= size && walk->size < best_size) {
-      best_size = walk->size;
-      best = walk;
-      best_prev = prev;
-      if (best_size + LARGE_OBJECT_HEADER_SIZE
-          == align(size + LARGE_OBJECT_HEADER_SIZE, CHUNK_SIZE))
-        // Not going to do any better than this; just return it.
-        break;
-    }
-  }
+allocate_large_object(size_t size, int *fresh) {
+  size_t chunks =
+    align(size + LARGE_OBJECT_HEADER_SIZE, CHUNK_SIZE) >> CHUNK_SIZE_LOG_2;
+  struct large_object *best = find_free_large_object(chunks);
+  size_t best_size;
+  int from_pages = 0;
 
-  if (!best) {
-    // The large object freelist doesn't have an object big enough for this
+  if (best) {
+    remove_free_large_object(best);
+    best_size = best->size;
+  } else {
+    // The large object freelists don't have an object big enough for this
     // allocation.  Allocate one or more pages from the OS, and treat that new
     // sequence of pages as a fresh large object.  It will be split if
     // necessary.
@@ -305,81 +533,41 @@ allocate_large_object(size_t size) {
     char *ptr = allocate_chunk(page, FIRST_ALLOCATABLE_CHUNK, LARGE_OBJECT);
     best = (struct large_object *)ptr;
     size_t page_header = ptr - ((char*) page);
-    best->next = large_objects;
     best->size = best_size =
       n_allocated * PAGE_SIZE - page_header - LARGE_OBJECT_HEADER_SIZE;
     ASSERT(best_size >= size_with_header);
+    from_pages = 1;
   }
+  if (fresh)
+    *fresh = from_pages;
 
   allocate_chunk(get_page(best), get_chunk_index(best), LARGE_OBJECT);
 
-  struct large_object *next = best->next;
-  *best_prev = next;
-
+  struct page *start_page = get_page(best);
+  char *start = get_large_object_payload(best);
+  char *end = start + best_size;
   size_t tail_size = (best_size - size) & ~CHUNK_MASK;
-  if (tail_size) {
-    // The best-fitting object has 1 or more aligned chunks free after the
-    // requested allocation; split the tail off into a fresh aligned object.
-    struct page *start_page = get_page(best);
-    char *start = get_large_object_payload(best);
-    char *end = start + best_size;
+  if (tail_size && start_page != get_page(end - tail_size - 1)
+      && size < PAGE_SIZE - LARGE_OBJECT_HEADER_SIZE - CHUNK_SIZE) {
+    // If the allocation itself smaller than a page but would straddle a page
+    // boundary, split off the head, then fall through to maybe split the tail.
+    ASSERT_ALIGNED((uintptr_t)end, PAGE_SIZE);
+    size_t first_page_size = PAGE_SIZE - (((uintptr_t)start) & PAGE_MASK);
+    struct large_object *head = best;
 
-    if (start_page == get_page(end - tail_size - 1)) {
-      // The allocation does not span a page boundary; yay.
-      ASSERT_ALIGNED((uintptr_t)end, CHUNK_SIZE);
-    } else if (size < PAGE_SIZE - LARGE_OBJECT_HEADER_SIZE - CHUNK_SIZE) {
-      // If the allocation itself smaller than a page, split off the head, then
-      // fall through to maybe split the tail.
-      ASSERT_ALIGNED((uintptr_t)end, PAGE_SIZE);
-      size_t first_page_size = PAGE_SIZE - (((uintptr_t)start) & PAGE_MASK);
-      struct large_object *head = best;
-      allocate_chunk(start_page, get_chunk_index(start), FREE_LARGE_OBJECT);
-      head->size = first_page_size;
-      head->next = large_objects;
-      large_objects = head;
-
-      maybe_repurpose_single_chunk_large_objects_head();
-
-      struct page *next_page = start_page + 1;
-      char *ptr = allocate_chunk(next_page, FIRST_ALLOCATABLE_CHUNK, LARGE_OBJECT);
-      best = (struct large_object *) ptr;
-      best->size = best_size = best_size - first_page_size - CHUNK_SIZE - LARGE_OBJECT_HEADER_SIZE;
-      ASSERT(best_size >= size);
-      start = get_large_object_payload(best);
-      tail_size = (best_size - size) & ~CHUNK_MASK;
-    } else {
-      // A large object that spans more than one page will consume all of its
-      // tail pages.  Therefore if the split traverses a page boundary, round up
-      // to page size.
-      ASSERT_ALIGNED((uintptr_t)end, PAGE_SIZE);
-      size_t first_page_size = PAGE_SIZE - (((uintptr_t)start) & PAGE_MASK);
-      size_t tail_pages_size = align(size - first_page_size, PAGE_SIZE);
-      size = first_page_size + tail_pages_size;
-      tail_size = best_size - size;
-    }
-    best->size -= tail_size;
-    
-    unsigned tail_idx = get_chunk_index(end - tail_size);
-    while (tail_idx < FIRST_ALLOCATABLE_CHUNK && tail_size) {
-      // We would be splitting in a page header; don't do that.
-      tail_size -= CHUNK_SIZE;
-      tail_idx++;
-    }
-    
-    if (tail_size) {
-      struct page *page = get_page(end - tail_size);
-      char *tail_ptr = allocate_chunk(page, tail_idx, FREE_LARGE_OBJECT);
-      struct large_object *tail = (struct large_object *) tail_ptr;
-      tail->next = large_objects;
-      tail->size = tail_size - LARGE_OBJECT_HEADER_SIZE;
-      ASSERT_ALIGNED((uintptr_t)(get_large_object_payload(tail) + tail->size), CHUNK_SIZE);
-      large_objects = tail;
+    // Claim the next page before releasing the head, whose right neighbour
+    // lookup reads that page's header.
+    struct page *next_page = start_page + 1;
+    char *ptr = allocate_chunk(next_page, FIRST_ALLOCATABLE_CHUNK, LARGE_OBJECT);
+    best = (struct large_object *) ptr;
+    best->size = best_size - first_page_size - CHUNK_SIZE - LARGE_OBJECT_HEADER_SIZE;
+    ASSERT(best->size >= size);
 
-      maybe_repurpose_single_chunk_large_objects_head();
-    }
+    head->size = first_page_size;
+    free_large_object(head);
   }
 
-  ASSERT_ALIGNED((uintptr_t)(get_large_object_payload(best) + best->size), CHUNK_SIZE);
+  split_large_object_tail(best, size);
   return best;
 }
 
@@ -391,7 +579,7 @@ obtain_small_objects(enum chunk_kind kind) {
     chunk = *whole_chunk_freelist;
     *whole_chunk_freelist = (*whole_chunk_freelist)->next;
   } else {
-    chunk = allocate_large_object(0);
+    chunk = allocate_large_object(0, NULL);
     if (!chunk) {
       return NULL;
     }
@@ -416,6 +604,118 @@ static struct freelist** get_small_object_freelist(enum chunk_kind kind) {
   return &small_object_freelists[kind];
 }
 
+#ifdef WALLOC_THREADS
+// With WALLOC_THREADS the allocator can be shared between wasm threads on a
+// shared memory.  Pages and large objects sit behind a single spinlock.
+// Small objects come from a per-thread cache for each size class, so the
+// common malloc and free touch no shared state.  A cache that runs dry takes
+// a batch of at most THREAD_CACHE_BATCH objects off the shared list for its
+// class under the lock, leaving the rest for other threads, and carves a
+// fresh chunk only if that list is empty too.  A cache that grows past
+// THREAD_CACHE_LIMIT pushes a batch back onto the shared list with a CAS and
+// no lock; as only lock holders pop, the pops cannot suffer ABA.  The shared list doubles as the remote-free queue: an object freed
+// by another thread than the one that allocated it lands in the freeing
+// thread's cache and travels back through the shared list from there.
+// Objects cached by a thread that exits are not reclaimed.
+#define THREAD_CACHE_LIMIT 64
+#define THREAD_CACHE_BATCH 32
+
+static int heap_lock;
+
+static inline void lock_heap(void) {
+  while (__atomic_exchange_n(&heap_lock, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&heap_lock, __ATOMIC_RELAXED))
+      ;
+}
+static inline void unlock_heap(void) {
+  __atomic_store_n(&heap_lock, 0, __ATOMIC_RELEASE);
+}
+
+struct thread_cache {
+  struct freelist *freelists[SMALL_OBJECT_CHUNK_KINDS];
+  unsigned counts[SMALL_OBJECT_CHUNK_KINDS];
+};
+static _Thread_local struct thread_cache thread_cache;
+static struct freelist *shared_small_object_freelists[SMALL_OBJECT_CHUNK_KINDS];
+
+static struct freelist*
+refill_thread_cache(enum chunk_kind kind) {
+  struct freelist **shared = &shared_small_object_freelists[kind];
+  struct freelist *head, *tail;
+  unsigned count;
+
+  lock_heap();
+  head = __atomic_load_n(shared, __ATOMIC_ACQUIRE);
+  while (head) {
+    // Frees may push in front of HEAD meanwhile; the CAS then fails and the
+    // batch is cut again from the new top.
+    tail = head;
+    count = 1;
+    for (; count < THREAD_CACHE_BATCH && tail->next; count++)
+      tail = tail->next;
+    if (__atomic_compare_exchange_n(shared, &head, tail->next, 1,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      break;
+  }
+  if (head) {
+    tail->next = NULL;
+  } else {
+    head = obtain_small_objects(kind);
+    count = CHUNK_SIZE / (chunk_kind_to_granules(kind) * GRANULE_SIZE);
+  }
+  unlock_heap();
+  if (!head)
+    return NULL;
+
+  thread_cache.freelists[kind] = head;
+  thread_cache.counts[kind] = count;
+  return head;
+}
+
+static void
+flush_thread_cache(enum chunk_kind kind) {
+  struct freelist *head = thread_cache.freelists[kind];
+  struct freelist *tail = head;
+  for (unsigned i = 1; i < THREAD_CACHE_BATCH; i++)
+    tail = tail->next;
+  thread_cache.freelists[kind] = tail->next;
+  thread_cache.counts[kind] -= THREAD_CACHE_BATCH;
+
+  struct freelist **shared = &shared_small_object_freelists[kind];
+  struct freelist *top = __atomic_load_n(shared, __ATOMIC_RELAXED);
+  do {
+    tail->next = top;
+  } while (!__atomic_compare_exchange_n(shared, &top, head, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void*
+allocate_small(enum chunk_kind kind) {
+  ASSERT(kind < SMALL_OBJECT_CHUNK_KINDS);
+  struct freelist *ret = thread_cache.freelists[kind];
+  if (!ret) {
+    ret = refill_thread_cache(kind);
+    if (!ret)
+      return NULL;
+  }
+  thread_cache.freelists[kind] = ret->next;
+  thread_cache.counts[kind]--;
+  return (void *) ret;
+}
+
+static void
+free_small(void *ptr, enum chunk_kind kind) {
+  ASSERT(kind < SMALL_OBJECT_CHUNK_KINDS);
+  struct freelist *obj = ptr;
+  obj->next = thread_cache.freelists[kind];
+  thread_cache.freelists[kind] = obj;
+  if (++thread_cache.counts[kind] > THREAD_CACHE_LIMIT)
+    flush_thread_cache(kind);
+}
+#else
+#define lock_heap() do { } while (0)
+#define unlock_heap() do { } while (0)
+
 static void*
 allocate_small(enum chunk_kind kind) {
   struct freelist **loc = get_small_object_freelist(kind);
@@ -431,38 +731,432 @@ allocate_small(enum chunk_kind kind) {
   return (void *) ret;
 }
 
+static void
+free_small(void *ptr, enum chunk_kind kind) {
+  struct freelist **loc = get_small_object_freelist(kind);
+  struct freelist *obj = ptr;
+  obj->next = *loc;
+  *loc = obj;
+}
+#endif
+
 static void*
 allocate_large(size_t size) {
-  struct large_object *obj = allocate_large_object(size);
+  lock_heap();
+  struct large_object *obj = allocate_large_object(size, NULL);
+  unlock_heap();
   return obj ? get_large_object_payload(obj) : NULL;
 }
   
+#ifdef WALLOC_TRACE
+// Report every allocation, free and in-place resize to the host, so that it
+// can record a trace for bench/walloc_bench.  OP is 'a', 'f' or 'r'.
+__attribute__((import_name("walloc_trace")))
+void walloc_trace(int op, void *ptr, size_t size);
+#define TRACE(op, ptr, size) walloc_trace(op, ptr, size)
+#else
+#define TRACE(op, ptr, size) do { } while (0)
+#endif
+
 __attribute__((export_name("malloc"))) 
 void*
 malloc(size_t size) {
   size_t granules = size_to_granules(size);
   enum chunk_kind kind = granules_to_chunk_kind(granules);
-  return (kind == LARGE_OBJECT) ? allocate_large(size) : allocate_small(kind);
+  void *ret = (kind == LARGE_OBJECT) ? allocate_large(size) : allocate_small(kind);
+  if (ret)
+    TRACE('a', ret, size);
+  return ret;
+}
+
+// Alignments up to half a chunk are supported.  Small objects of a
+// power-of-two granule count are naturally aligned to their size within
+// their chunk, and a large object's payload can be offset within its first
+// chunk, which free() still maps back to the header.
+#define MAX_ALIGNMENT (CHUNK_SIZE / 2)
+
+__attribute__((export_name("aligned_alloc"))) 
+void*
+aligned_alloc(size_t alignment, size_t size) {
+  if (alignment & (alignment - 1) || alignment > MAX_ALIGNMENT)
+    return NULL;
+  if (alignment <= GRANULE_SIZE)
+    return malloc(size);
+
+  void *ret;
+  if (max(size, alignment) <= LARGE_OBJECT_THRESHOLD) {
+    unsigned granules = 1;
+    while (granules * GRANULE_SIZE < max(size, alignment))
+      granules <<= 1;
+    ret = allocate_small(granules_to_chunk_kind(granules));
+  } else {
+    lock_heap();
+    struct large_object *obj =
+      allocate_large_object(size + alignment - LARGE_OBJECT_HEADER_SIZE, NULL);
+    unlock_heap();
+    ret = obj ? ((char*) obj) + alignment : NULL;
+  }
+  if (ret)
+    TRACE('a', ret, size);
+  return ret;
+}
+
+#define WALLOC_EINVAL 22
+#define WALLOC_ENOMEM 12
+
+__attribute__((export_name("posix_memalign"))) 
+int
+posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if (alignment & (alignment - 1) || alignment % sizeof(void*)
+      || alignment > MAX_ALIGNMENT)
+    return WALLOC_EINVAL;
+  void *ptr = aligned_alloc(alignment, size);
+  if (!ptr)
+    return WALLOC_ENOMEM;
+  *memptr = ptr;
+  return 0;
 }
 
 __attribute__((export_name("free"))) 
 void
 free(void *ptr) {
   if (!ptr) return;
+  TRACE('f', ptr, 0);
+  struct page *page = get_page(ptr);
+  unsigned chunk = get_chunk_index(ptr);
+  uint8_t kind = page->header.chunk_kinds[chunk];
+  if (kind == LARGE_OBJECT) {
+    lock_heap();
+    free_large_object(get_large_object(ptr));
+    unlock_heap();
+  } else {
+    free_small(ptr, kind);
+  }
+}
+
+// Memory from fresh pages is already zeroed, so only recycled memory needs
+// clearing.
+__attribute__((export_name("calloc"))) 
+void*
+calloc(size_t count, size_t size) {
+  if (size && count > (size_t) -1 / size)
+    return NULL;
+  size_t total = count * size;
+  size_t granules = size_to_granules(total);
+  enum chunk_kind kind = granules_to_chunk_kind(granules);
+  if (kind != LARGE_OBJECT) {
+    void *ptr = allocate_small(kind);
+    if (ptr) {
+      __builtin_memset(ptr, 0, total);
+      TRACE('a', ptr, total);
+    }
+    return ptr;
+  }
+  int fresh = 0;
+  lock_heap();
+  struct large_object *obj = allocate_large_object(total, &fresh);
+  unlock_heap();
+  if (!obj)
+    return NULL;
+  void *ptr = get_large_object_payload(obj);
+  if (!fresh)
+    __builtin_memset(ptr, 0, total);
+  TRACE('a', ptr, total);
+  return ptr;
+}
+
+__attribute__((export_name("realloc"))) 
+void*
+realloc(void *ptr, size_t size) {
+  if (!ptr)
+    return malloc(size);
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+
   struct page *page = get_page(ptr);
   unsigned chunk = get_chunk_index(ptr);
   uint8_t kind = page->header.chunk_kinds[chunk];
+  size_t old_size;
+  int resized;
   if (kind == LARGE_OBJECT) {
     struct large_object *obj = get_large_object(ptr);
-    obj->next = large_objects;
-    large_objects = obj;
-    allocate_chunk(page, chunk, FREE_LARGE_OBJECT);
-    pending_large_object_compact = 1;
+    size_t offset = ((char*) ptr) - ((char*) get_large_object_payload(obj));
+    lock_heap();
+    resized = resize_large_object(obj, size + offset);
+    old_size = obj->size - offset;
+    unlock_heap();
   } else {
-    size_t granules = kind;
-    struct freelist **loc = get_small_object_freelist(granules);
-    struct freelist *obj = ptr;
-    obj->next = *loc;
-    *loc = obj;
+    old_size = chunk_kind_to_granules(kind) * GRANULE_SIZE;
+    resized = size <= old_size;
+  }
+  if (resized) {
+    TRACE('r', ptr, size);
+    return ptr;
+  }
+
+  void *ret = malloc(size);
+  if (ret) {
+    __builtin_memcpy(ret, ptr, old_size < size ? old_size : size);
+    free(ptr);
   }
-}
\ No newline at end of file
+  return ret;
+}
+
+// Zones bump-allocate out of spans, each span a large object.  Releasing a
+// zone frees just its spans, which coalesce with free neighbours like any
+// large object, so a scene's assets can be dropped in one call without
+// visiting the objects inside.  Requests bigger than a quarter span get a
+// span of their own, so they don't waste the rest of the current one.
+//
+// Memory from walloc_zone_malloc() must not be passed to free() or
+// realloc().  A zone is not synchronized; with WALLOC_THREADS only obtaining
+// and releasing its spans takes the heap lock.
+struct zone_span {
+  union {
+    struct zone_span *next;
+    char header[GRANULE_SIZE];
+  };
+};
+
+struct walloc_zone {
+  struct zone_span *spans;
+  char *cursor;
+  char *limit;
+  size_t span_size;
+};
+
+#define ZONE_DEFAULT_SPAN_SIZE \
+  (PAGE_SIZE - PAGE_HEADER_SIZE - LARGE_OBJECT_HEADER_SIZE \
+   - sizeof (struct zone_span))
+
+__attribute__((export_name("walloc_zone_create")))
+struct walloc_zone*
+walloc_zone_create(size_t span_size) {
+  struct walloc_zone *zone = malloc(sizeof (struct walloc_zone));
+  if (!zone)
+    return NULL;
+  zone->spans = NULL;
+  zone->cursor = zone->limit = NULL;
+  zone->span_size = span_size ? span_size : ZONE_DEFAULT_SPAN_SIZE;
+  return zone;
+}
+
+static struct zone_span*
+allocate_zone_span(struct walloc_zone *zone, size_t size) {
+  lock_heap();
+  struct large_object *obj =
+    allocate_large_object(sizeof (struct zone_span) + size, NULL);
+  unlock_heap();
+  if (!obj)
+    return NULL;
+  struct zone_span *span = get_large_object_payload(obj);
+  TRACE('a', span, sizeof (struct zone_span) + size);
+  span->next = zone->spans;
+  zone->spans = span;
+  return span;
+}
+
+__attribute__((export_name("walloc_zone_malloc")))
+void*
+walloc_zone_malloc(struct walloc_zone *zone, size_t size) {
+  size = align(max(size, 1), GRANULE_SIZE);
+  if (size <= (size_t) (zone->limit - zone->cursor)) {
+    void *ret = zone->cursor;
+    zone->cursor += size;
+    return ret;
+  }
+
+  if (size > zone->span_size / 4) {
+    struct zone_span *span = allocate_zone_span(zone, size);
+    return span ? span + 1 : NULL;
+  }
+
+  struct zone_span *span = allocate_zone_span(zone, zone->span_size);
+  if (!span)
+    return NULL;
+  struct large_object *obj = get_large_object(span);
+  zone->cursor = ((char*) (span + 1)) + size;
+  zone->limit = ((char*) get_large_object_payload(obj)) + obj->size;
+  return span + 1;
+}
+
+// Free everything allocated from ZONE.  The zone stays usable.
+__attribute__((export_name("walloc_zone_release")))
+void
+walloc_zone_release(struct walloc_zone *zone) {
+  struct zone_span *span = zone->spans;
+  lock_heap();
+  while (span) {
+    struct zone_span *next = span->next;
+    TRACE('f', span, 0);
+    free_large_object(get_large_object(span));
+    span = next;
+  }
+  unlock_heap();
+  zone->spans = NULL;
+  zone->cursor = zone->limit = NULL;
+}
+
+__attribute__((export_name("walloc_zone_destroy")))
+void
+walloc_zone_destroy(struct walloc_zone *zone) {
+  if (!zone)
+    return;
+  walloc_zone_release(zone);
+  free(zone);
+}
+
+// Heap statistics, refreshed by walloc_stats() and then read in place by the
+// host.  Every field is a size_t, so on wasm32 the struct is a run of 32-bit
+// words in declaration order.  With WALLOC_THREADS, objects sitting in other
+// threads' caches are counted as live.
+struct walloc_stats {
+  size_t heap_start;
+  size_t heap_pages;
+  size_t grow_count;
+  size_t grow_bytes;
+  size_t large_live_objects;
+  size_t large_live_bytes;
+  size_t free_large_objects;
+  size_t free_large_bytes;
+  size_t largest_free_large_object;
+  // Per mille of free large-object bytes outside the largest free object.
+  size_t fragmentation;
+  size_t small_free_bytes;
+  size_t small_object_kinds;
+  size_t small_object_sizes[SMALL_OBJECT_CHUNK_KINDS];
+  size_t small_live_bytes[SMALL_OBJECT_CHUNK_KINDS];
+};
+
+// One record of walloc_walk(): a small-object chunk, or a large object with
+// its header.  KIND is the chunk kind: a small-object size class index,
+// FREE_LARGE_OBJECT or LARGE_OBJECT.  SIZE includes the page headers of any
+// pages a large object spans.
+struct walloc_chunk_info {
+  uintptr_t start;
+  size_t size;
+  unsigned kind;
+  unsigned object_size;
+};
+
+// Pages are tiled by small-object chunks and large objects, and a large
+// object that runs past its first page ends on a page boundary, so the heap
+// can be walked from its first allocatable chunk.  Returns where the object
+// after the one at PTR starts.
+static char*
+describe_heap_object(char *ptr, struct walloc_chunk_info *info) {
+  uint8_t kind = get_page(ptr)->header.chunk_kinds[get_chunk_index(ptr)];
+  char *end;
+  if (kind < SMALL_OBJECT_CHUNK_KINDS) {
+    end = ptr + CHUNK_SIZE;
+    info->object_size = chunk_kind_to_granules(kind) * GRANULE_SIZE;
+  } else {
+    ASSERT(kind == LARGE_OBJECT || kind == FREE_LARGE_OBJECT);
+    end = get_large_object_end((struct large_object*) ptr);
+    info->object_size = 0;
+  }
+  info->start = (uintptr_t) ptr;
+  info->size = end - ptr;
+  info->kind = kind;
+  if (!(((uintptr_t) end) & PAGE_MASK))
+    end += PAGE_HEADER_SIZE;
+  return end;
+}
+
+static inline char* get_heap_begin(void) {
+  return ((char*) walloc_heap_start) + PAGE_HEADER_SIZE;
+}
+static inline char* get_heap_end(void) {
+  return ((char*) walloc_heap_start) + walloc_heap_size;
+}
+
+static size_t
+count_free_small_bytes(struct freelist *freelist, enum chunk_kind kind) {
+  size_t count = 0;
+  for (; freelist; freelist = freelist->next)
+    count++;
+  return count * chunk_kind_to_granules(kind) * GRANULE_SIZE;
+}
+
+static struct walloc_stats stats;
+
+__attribute__((export_name("walloc_stats")))
+struct walloc_stats*
+walloc_stats(void) {
+  size_t small_chunks[SMALL_OBJECT_CHUNK_KINDS] = { 0 };
+  size_t small_free[SMALL_OBJECT_CHUNK_KINDS] = { 0 };
+
+  lock_heap();
+  stats.heap_start = walloc_heap_start;
+  stats.heap_pages = walloc_heap_size / PAGE_SIZE;
+  stats.grow_count = walloc_grow_count;
+  stats.grow_bytes = walloc_grow_bytes;
+  stats.large_live_objects = stats.large_live_bytes = 0;
+  stats.free_large_objects = stats.free_large_bytes = 0;
+  stats.largest_free_large_object = 0;
+
+  struct walloc_chunk_info info;
+  for (char *ptr = get_heap_begin(); ptr < get_heap_end();
+       ptr = describe_heap_object(ptr, &info)) {
+    uint8_t kind = get_page(ptr)->header.chunk_kinds[get_chunk_index(ptr)];
+    if (kind < SMALL_OBJECT_CHUNK_KINDS) {
+      small_chunks[kind]++;
+    } else {
+      size_t size = ((struct large_object*) ptr)->size;
+      if (kind == LARGE_OBJECT) {
+        stats.large_live_objects++;
+        stats.large_live_bytes += size;
+      } else {
+        stats.free_large_objects++;
+        stats.free_large_bytes += size;
+        stats.largest_free_large_object =
+          max(stats.largest_free_large_object, size);
+      }
+    }
+  }
+
+  for (unsigned kind = 0; kind < SMALL_OBJECT_CHUNK_KINDS; kind++) {
+    small_free[kind] = count_free_small_bytes(small_object_freelists[kind], kind);
+#ifdef WALLOC_THREADS
+    small_free[kind] +=
+      count_free_small_bytes(thread_cache.freelists[kind], kind)
+      + count_free_small_bytes(__atomic_load_n(&shared_small_object_freelists[kind],
+                                               __ATOMIC_ACQUIRE), kind);
+#endif
+  }
+  unlock_heap();
+
+  stats.small_free_bytes = 0;
+  stats.small_object_kinds = SMALL_OBJECT_CHUNK_KINDS;
+  for (unsigned kind = 0; kind < SMALL_OBJECT_CHUNK_KINDS; kind++) {
+    size_t size = chunk_kind_to_granules(kind) * GRANULE_SIZE;
+    stats.small_object_sizes[kind] = size;
+    stats.small_live_bytes[kind] =
+      small_chunks[kind] * (CHUNK_SIZE / size) * size - small_free[kind];
+    stats.small_free_bytes += small_free[kind];
+  }
+  stats.fragmentation = stats.free_large_bytes
+    ? 1000 - (size_t) ((unsigned long long) stats.largest_free_large_object
+                       * 1000 / stats.free_large_bytes)
+    : 0;
+  return &stats;
+}
+
+// Fill OUT with up to CAPACITY records, in address order, and return how
+// many records the whole heap takes.
+__attribute__((export_name("walloc_walk")))
+size_t
+walloc_walk(struct walloc_chunk_info *out, size_t capacity) {
+  size_t count = 0;
+  struct walloc_chunk_info info;
+  lock_heap();
+  for (char *ptr = get_heap_begin(); ptr < get_heap_end(); count++) {
+    ptr = describe_heap_object(ptr, &info);
+    if (count < capacity)
+      out[count] = info;
+  }
+  unlock_heap();
+  return count;
+}
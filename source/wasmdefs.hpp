@@ -8,10 +8,28 @@ using uint8_t = __UINT8_TYPE__;
 using u64 = unsigned long long;
 using i64 = long long;
 using u32 = unsigned int;
+using u16 = unsigned short;
+using u8 = unsigned char;
 using i32 = int;
+using i16 = short;
 using f32 = float;
 using f64 = double;
 
+extern "C" {
+    void* malloc(size_t size);
+    void* calloc(size_t count, size_t size);
+    void* realloc(void *ptr, size_t size);
+    void* aligned_alloc(size_t alignment, size_t size);
+    i32 posix_memalign(void **memptr, size_t alignment, size_t size);
+    void free(void *ptr);
+
+    struct walloc_zone;
+    walloc_zone* walloc_zone_create(size_t span_size);
+    void* walloc_zone_malloc(walloc_zone *zone, size_t size);
+    void walloc_zone_release(walloc_zone *zone);
+    void walloc_zone_destroy(walloc_zone *zone);
+}
+
 static void* memset(void *dst, i32 val, u64 size)
 {
 #if __has_builtin(__builtin_memset)